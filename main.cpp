@@ -1,9 +1,44 @@
 #include <iostream>
 #include <vector>
+#include <array>
 #include <string>
 #include <fstream>
 #include <sstream>
-#include <typeinfo>
+#include <type_traits>
+#include <cctype>
+#include <cstdlib>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cfloat>
+#include <cstdio>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
+#include <sys/stat.h>
 #include <SFML/Window.hpp>
 #include <GL/glew.h>
 #include <glm.hpp>
@@ -19,7 +54,6 @@ bool createShader(const std::string& file_name, const GLenum type, GLuint& shade
 	{
 		std::cerr << "Cannot create " + std::to_string(new_shader) + " shader" << std::endl;
 		glGetError();
-		std::cin.get();
 		return false;
 	}
 	else
@@ -28,7 +62,6 @@ bool createShader(const std::string& file_name, const GLenum type, GLuint& shade
 		if (!file.good())
 		{
 			std::cerr << "Cannot open " + file_name + " shader file" << std::endl;
-			std::cin.get();
 			return false;
 		}
 
@@ -56,7 +89,6 @@ bool createShader(const std::string& file_name, const GLenum type, GLuint& shade
 			glGetShaderInfoLog(new_shader, size, NULL, log);
 			std::cerr << "Cannot compile " + std::to_string(new_shader) + " shader" << std::endl << log << std::endl;
 			delete[] log;
-			std::cin.get();
 			return false;
 		}
 	}
@@ -66,7 +98,7 @@ bool createShader(const std::string& file_name, const GLenum type, GLuint& shade
 	return true;
 }
 
-bool createProgram(std::vector<GLuint> shaders, GLuint& program)
+bool createProgram(std::vector<GLuint> shaders, const std::vector<const GLchar*>& feedback_varyings, GLuint& program)
 {
 	GLuint new_program = glCreateProgram();
 
@@ -74,7 +106,6 @@ bool createProgram(std::vector<GLuint> shaders, GLuint& program)
 	{
 		std::cerr << "Cannot create " + std::to_string(new_program) + " program" << std::endl;
 		glGetError();
-		std::cin.get();
 		return false;
 	}
 	else
@@ -87,18 +118,23 @@ bool createProgram(std::vector<GLuint> shaders, GLuint& program)
 			if ((error = glGetError()) != GL_NO_ERROR)
 			{
 				std::cerr << "Attach shader error: " << error << std::endl;
-				std::cin.get();
-				return false;
+					return false;
 			}
 		}
 
+		if (!feedback_varyings.empty())
+			glTransformFeedbackVaryings(new_program, static_cast<GLsizei>(feedback_varyings.size()), feedback_varyings.data(), GL_INTERLEAVED_ATTRIBS);
+
 		glLinkProgram(new_program);
 		GLint status;
 		glGetProgramiv(new_program, GL_LINK_STATUS, &status);
 		if (status == GL_FALSE)
 		{
-			std::cerr << "Cannot link " + std::to_string(new_program) + " program" << std::endl;
-			std::cin.get();
+			GLint size;
+			glGetProgramiv(new_program, GL_INFO_LOG_LENGTH, &size);
+			std::vector<GLchar> log(size + 1, '\0');
+			glGetProgramInfoLog(new_program, size + 1, NULL, log.data());
+			std::cerr << "Cannot link " + std::to_string(new_program) + " program" << std::endl << log.data() << std::endl;
 			return false;
 		}
 
@@ -106,8 +142,11 @@ bool createProgram(std::vector<GLuint> shaders, GLuint& program)
 		glGetProgramiv(new_program, GL_VALIDATE_STATUS, &status);
 		if (status == GL_FALSE)
 		{
-			std::cerr << "Cannot validate " + std::to_string(new_program) + " program" << std::endl;
-			std::cin.get();
+			GLint size;
+			glGetProgramiv(new_program, GL_INFO_LOG_LENGTH, &size);
+			std::vector<GLchar> log(size + 1, '\0');
+			glGetProgramInfoLog(new_program, size + 1, NULL, log.data());
+			std::cerr << "Cannot validate " + std::to_string(new_program) + " program" << std::endl << log.data() << std::endl;
 			return false;
 		}
 	}
@@ -117,481 +156,5965 @@ bool createProgram(std::vector<GLuint> shaders, GLuint& program)
 	return true;
 }
 
+struct PythagorasInstanceLocations
+{
+	GLint origin;
+	GLint rotation;
+	GLint side;
+	GLint iter;
+	GLint corners;
+};
+
+struct ShaderProgram
+{
+	GLuint                       id;
+	std::map<std::string, GLint> uniforms;
+	std::map<std::string, GLint> attributes;
+	PythagorasInstanceLocations  instances;
+};
+
+GLint uniformLocation(const ShaderProgram& program, const std::string& name)
+{
+	const std::map<std::string, GLint>::const_iterator i = program.uniforms.find(name);
+	return i != program.uniforms.end() ? i->second : -1;
+}
+
+GLint attributeLocation(const ShaderProgram& program, const std::string& name)
+{
+	const std::map<std::string, GLint>::const_iterator i = program.attributes.find(name);
+	return i != program.attributes.end() ? i->second : -1;
+}
+
+bool createShaderProgram(const std::vector<GLuint>&        shaders,
+                         const std::vector<const GLchar*>& feedback_varyings,
+                         ShaderProgram&                    program)
+{
+	if (!createProgram(shaders, feedback_varyings, program.id))
+		return false;
+
+	// Locations are resolved once here, so drawing never has to ask the driver for them.
+	GLint count;
+	GLint max_length;
+	GLint size;
+	GLenum type;
+
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<GLchar> name(max_length + 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		glGetActiveUniform(program.id, i, static_cast<GLsizei>(name.size()), NULL, &size, &type, name.data());
+
+		// Members of uniform blocks have no location of their own.
+		const GLint location = glGetUniformLocation(program.id, name.data());
+		if (location != -1)
+			program.uniforms[name.data()] = location;
+	}
+
+	glGetProgramiv(program.id, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(program.id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+	name.resize(max_length + 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		glGetActiveAttrib(program.id, i, static_cast<GLsizei>(name.size()), NULL, &size, &type, name.data());
+		program.attributes[name.data()] = glGetAttribLocation(program.id, name.data());
+	}
+
+	// The square attributes are bound again for every drawn range, so they are also kept without the map.
+	program.instances.origin = attributeLocation(program, "in_origin");
+	program.instances.rotation = attributeLocation(program, "in_rotation");
+	program.instances.side = attributeLocation(program, "in_side");
+	program.instances.iter = attributeLocation(program, "in_iter");
+	program.instances.corners = attributeLocation(program, "in_corners");
+
+	return true;
+}
+
+void bindUniformBlock(const ShaderProgram& program, const std::string& name, const GLuint binding)
+{
+	const GLuint index = glGetUniformBlockIndex(program.id, name.c_str());
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program.id, index, binding);
+}
+
+// Multisampled color and depth of the window frame, which keeps the last picture for presenting it again.
+struct FrameTarget
+{
+	GLuint  framebuffer;
+	GLuint  renderbuffers[2];
+	GLsizei samples;
+};
+
+bool resizeFrameTarget(FrameTarget& target, const GLsizei width, const GLsizei height)
+{
+	glBindRenderbuffer(GL_RENDERBUFFER, target.renderbuffers[0]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, target.samples, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.renderbuffers[1]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, target.samples, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.renderbuffers[1]);
+	const bool is_complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!is_complete)
+	{
+		std::cerr << "Cannot create " + std::to_string(width) + "x" + std::to_string(height) + " window framebuffer" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool createFrameTarget(FrameTarget& target, const GLsizei width, const GLsizei height, const GLsizei samples)
+{
+	GLint max_samples;
+	glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+	target.samples = std::min(samples, static_cast<GLsizei>(max_samples));
+
+	glGenRenderbuffers(2, target.renderbuffers);
+	glGenFramebuffers(1, &target.framebuffer);
+
+	return resizeFrameTarget(target, width, height);
+}
+
+void presentFrameTarget(const FrameTarget& target, const GLsizei width, const GLsizei height)
+{
+	// Resolves the samples into the single sampled back buffer of the window.
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Matches the std140 layout of the Frame uniform block shared by the shaders.
+struct FrameUniforms
+{
+	glm::mat4 mvp_matrix;
+	glm::vec4 light_direction;
+};
+
+struct Settings
+{
+	bool        is_3d;
+	int         iters;
+	GLfloat     side;
+	GLfloat     depth;
+	float       angle;
+	glm::vec3   first_color;
+	glm::vec3   last_color;
+	bool        reversing;
+	bool        is_directed_light;
+	bool        is_dynamic_light;
+	unsigned    threads;
+	bool        is_compact_mesh;
+	float       lod_pixels;
+	bool        is_gpu_generated;
+	bool        is_cached;
+	float       angle_animation;
+	float       animation_period;
+	bool        is_instanced;
+	bool        is_on_demand;
+	std::string cache_directory;
+	unsigned    cache_files;
+};
+
+const char* const setting_labels[] =
+{
+	"3D mode",
+	"Iterations",
+	"Side length",
+	"Depth length",
+	"Left angle",
+	"First iteration color",
+	"Last iteration color",
+	"Reversing angle mode",
+	"Directed light mode",
+	"Dynamic light mode",
+	"Generation threads",
+	"Compact mesh mode",
+	"LOD pixel size",
+	"GPU generation",
+	"Generation cache",
+	"Angle animation",
+	"Animation period",
+	"Subtree instancing",
+	"On-demand rendering",
+	"Cache directory",
+	"Cache files"
+};
+
+const int settings_count = sizeof(setting_labels) / sizeof(setting_labels[0]);
+
+bool parseSettingValue(const std::string& text, bool& value)
+{
+	if (text == "true")
+		value = true;
+	else if (text == "false")
+		value = false;
+	else
+		return false;
+
+	return true;
+}
+
 template<class T>
-bool loadSetting(std::fstream& file, int labels_numbers_of_words[], T& setting, int line_number)
+bool parseSettingValue(const std::string& text, T& value)
+{
+	// The whole text has to be a number of the type; partly read values like "5x" are errors.
+	if (text.empty() || (text[0] == '-' && std::is_unsigned<T>::value))
+		return false;
+
+	std::stringstream sstream(text);
+	sstream >> value;
+
+	return !sstream.fail() && sstream.peek() == std::char_traits<char>::eof();
+}
+
+bool parseSettingValue(const std::string& text, std::string& value)
+{
+	if (text.empty())
+		return false;
+
+	value = text;
+	return true;
+}
+
+bool parseSettingValue(const std::string& text, glm::vec3& value)
+{
+	if (text.size() != 8 || text[0] != '0' || (text[1] != 'x' && text[1] != 'X'))
+		return false;
+
+	for (size_t i = 2; i < text.size(); i++)
+	{
+		if (!std::isxdigit(static_cast<unsigned char>(text[i])))
+			return false;
+	}
+
+	const int color = static_cast<int>(std::strtol(text.c_str() + 2, NULL, 16));
+	value.x = (color & 0xff0000) / glm::pow(255.f, 3);
+	value.y = (color & 0xff00) / glm::pow(255.f, 2);
+	value.z = (color & 0xff) / 255.f;
+
+	return true;
+}
+
+// Squares are counted in a size_t, so a tree has fewer levels than it has bits.
+const int max_pythagoras_iters = 8 * static_cast<int>(sizeof(size_t)) - 1;
+
+bool parseSetting(const int index, const std::string& text, Settings& settings)
+{
+	// The shape of the tree is checked here too, so a value it cannot have is reported where it was written.
+	switch (index)
+	{
+	case 0:  return parseSettingValue(text, settings.is_3d);
+	case 1:  return parseSettingValue(text, settings.iters) && settings.iters >= 1 && settings.iters <= max_pythagoras_iters;
+	case 2:  return parseSettingValue(text, settings.side) && settings.side > 0.f;
+	case 3:  return parseSettingValue(text, settings.depth);
+	case 4:  return parseSettingValue(text, settings.angle) && settings.angle > 0.f && settings.angle < 90.f;
+	case 5:  return parseSettingValue(text, settings.first_color);
+	case 6:  return parseSettingValue(text, settings.last_color);
+	case 7:  return parseSettingValue(text, settings.reversing);
+	case 8:  return parseSettingValue(text, settings.is_directed_light);
+	case 9:  return parseSettingValue(text, settings.is_dynamic_light);
+	case 10: return parseSettingValue(text, settings.threads);
+	case 11: return parseSettingValue(text, settings.is_compact_mesh);
+	case 12: return parseSettingValue(text, settings.lod_pixels);
+	case 13: return parseSettingValue(text, settings.is_gpu_generated);
+	case 14: return parseSettingValue(text, settings.is_cached);
+	case 15: return parseSettingValue(text, settings.angle_animation);
+	case 16: return parseSettingValue(text, settings.animation_period);
+	case 17: return parseSettingValue(text, settings.is_instanced);
+	case 18: return parseSettingValue(text, settings.is_on_demand);
+	case 19: return parseSettingValue(text, settings.cache_directory);
+	case 20: return parseSettingValue(text, settings.cache_files);
+	default: return false;
+	}
+}
+
+std::string settingFormat(const int index)
+{
+	switch (index)
+	{
+	case 1:  return "an integer from 1 to " + std::to_string(max_pythagoras_iters);
+	case 10:
+	case 20: return "a non-negative integer";
+	case 2:  return "a positive number";
+	case 4:  return "a number between 0 and 90, exclusive";
+	case 3:
+	case 12:
+	case 15:
+	case 16: return "a number";
+	case 5:
+	case 6:  return "a color like 0x904723";
+	case 19: return "a directory";
+	default: return "true or false";
+	}
+}
+
+int findSetting(const std::string& label)
+{
+	for (int i = 0; i < settings_count; i++)
+	{
+		if (label == setting_labels[i])
+			return i;
+	}
+
+	return -1;
+}
+
+void trimSetting(const std::string& line, size_t& first, size_t& last)
+{
+	while (first < last && std::isspace(static_cast<unsigned char>(line[first])))
+		first++;
+	while (last > first && std::isspace(static_cast<unsigned char>(line[last - 1])))
+		last--;
+}
+
+void defaultSettings(Settings& settings)
+{
+	settings.is_3d = true;
+	settings.iters = 5;
+	settings.side = 0.6f;
+	settings.depth = 0.2f;
+	settings.angle = 45.f;
+	parseSettingValue("0x904723", settings.first_color);
+	parseSettingValue("0x7cfc00", settings.last_color);
+	settings.reversing = false;
+	settings.is_directed_light = true;
+	settings.is_dynamic_light = false;
+	settings.threads = 0;
+	settings.is_compact_mesh = false;
+	settings.lod_pixels = 1.f;
+	settings.is_gpu_generated = false;
+	settings.is_cached = false;
+	settings.angle_animation = 0.f;
+	settings.animation_period = 4.f;
+	settings.is_instanced = false;
+	settings.is_on_demand = false;
+	settings.cache_directory = ".";
+	settings.cache_files = 8;
+}
+
+bool applySettingOverrides(const std::vector<std::string>& overrides, const std::string& position, Settings& settings)
 {
+	// Overrides are "Label=value"; all of them are checked before returning.
+	bool is_valid = true;
+
+	for (size_t i = 0; i < overrides.size(); i++)
+	{
+		const std::string& text = overrides[i];
+		const size_t equals = text.find('=');
+		const int index = equals == std::string::npos ? -1 : findSetting(text.substr(0, equals));
+
+		if (index == -1)
+		{
+			std::cerr << position + text + ": expected \"Label=value\" with a known label" << std::endl;
+			is_valid = false;
+		}
+		else if (!parseSetting(index, text.substr(equals + 1), settings))
+		{
+			std::cerr << position + text + ": \"" + setting_labels[index] + "\" has to be " + settingFormat(index) << std::endl;
+			is_valid = false;
+		}
+	}
+
+	return is_valid;
+}
+
+bool loadSettings(const std::string&              file_name,
+                  const std::string&              profile,
+                  const std::vector<std::string>& overrides,
+                  Settings&                       settings)
+{
+	std::ifstream file(file_name);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " settings file" << std::endl;
+		return false;
+	}
+
+	// "Label: value" lines before the first [profile] line apply to every profile; the lines of the chosen profile
+	// follow them and override them. Lines of other profiles are parsed into a scratch copy, so that their errors
+	// are reported as well.
+	defaultSettings(settings);
+	Settings other_settings = settings;
+
+	std::string section;
+	bool is_profile_found = profile.empty();
+	uint32_t section_labels = 0;
+	bool is_valid = true;
+
 	std::string line;
-	for (int i = 0; i < line_number; i++)
+	for (int line_number = 1; std::getline(file, line); line_number++)
+	{
+		const std::string position = file_name + ":" + std::to_string(line_number) + ":";
+
+		size_t first = 0;
+		size_t last = std::min(line.find('#'), line.size());
+		trimSetting(line, first, last);
+		if (first == last)
+			continue;
+
+		if (line[first] == '[')
+		{
+			if (line[last - 1] != ']' || last - first < 3)
+			{
+				std::cerr << position + std::to_string(first + 1) + ": expected [profile name]" << std::endl;
+				is_valid = false;
+				continue;
+			}
+
+			section = line.substr(first + 1, last - first - 2);
+			is_profile_found = is_profile_found || section == profile;
+			section_labels = 0;
+			continue;
+		}
+
+		const size_t colon = line.find(':', first);
+		if (colon >= last)
+		{
+			std::cerr << position + std::to_string(first + 1) + ": expected \"Label: value\"" << std::endl;
+			is_valid = false;
+			continue;
+		}
+
+		size_t label_last = colon;
+		trimSetting(line, first, label_last);
+		const int index = findSetting(line.substr(first, label_last - first));
+		if (index == -1)
+		{
+			std::cerr << position + std::to_string(first + 1) + ": unknown setting \"" + line.substr(first, label_last - first) + "\"" << std::endl;
+			is_valid = false;
+			continue;
+		}
+
+		if (section_labels & (1u << index))
+		{
+			std::cerr << position + std::to_string(first + 1) + ": \"" + setting_labels[index] + "\" is set twice" << std::endl;
+			is_valid = false;
+			continue;
+		}
+		section_labels |= 1u << index;
+
+		size_t value_first = colon + 1;
+		trimSetting(line, value_first, last);
+		if (!parseSetting(index, line.substr(value_first, last - value_first), section.empty() || section == profile ? settings : other_settings))
+		{
+			std::cerr << position + std::to_string(value_first + 1) + ": \"" + setting_labels[index] + "\" has to be " + settingFormat(index) << std::endl;
+			is_valid = false;
+		}
+	}
+
+	if (!is_profile_found)
+	{
+		std::cerr << file_name + ": no [" + profile + "] profile" << std::endl;
+		is_valid = false;
+	}
+
+	// Command line overrides come last.
+	return applySettingOverrides(overrides, "--set ", settings) && is_valid;
+}
+
+struct PythagorasNode
+{
+	glm::vec3 origin;
+	glm::vec2 direction;
+	float     abs_angle;
+	float     side;
+};
+
+struct PythagorasNodes
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> direction_x;
+	std::vector<float> direction_y;
+	std::vector<float> abs_angle;
+	std::vector<float> side;
+};
+
+void resizePythagorasNodes(PythagorasNodes& nodes, const size_t count)
+{
+	nodes.x.resize(count);
+	nodes.y.resize(count);
+	nodes.direction_x.resize(count);
+	nodes.direction_y.resize(count);
+	nodes.abs_angle.resize(count);
+	nodes.side.resize(count);
+}
+
+PythagorasNode loadPythagorasNode(const PythagorasNodes& nodes, const size_t i)
+{
+	PythagorasNode node;
+	node.origin = glm::vec3(nodes.x[i], nodes.y[i], 0.f);
+	node.direction = glm::vec2(nodes.direction_x[i], nodes.direction_y[i]);
+	node.abs_angle = nodes.abs_angle[i];
+	node.side = nodes.side[i];
+
+	return node;
+}
+
+void storePythagorasNode(PythagorasNodes& nodes, const size_t i, const PythagorasNode& node)
+{
+	nodes.x[i] = node.origin.x;
+	nodes.y[i] = node.origin.y;
+	nodes.direction_x[i] = node.direction.x;
+	nodes.direction_y[i] = node.direction.y;
+	nodes.abs_angle[i] = node.abs_angle;
+	nodes.side[i] = node.side;
+}
+
+PythagorasNode pythagorasRootNode(const GLfloat side)
+{
+	PythagorasNode root;
+	root.origin = glm::vec3(0.f);
+	root.direction = glm::vec2(1.f, 0.f);
+	root.abs_angle = 0.f;
+	root.side = side;
+
+	return root;
+}
+
+struct PythagorasSquare
+{
+	GLfloat x;
+	GLfloat y;
+	GLfloat rotation;
+	GLfloat side;
+	GLint   iter;
+};
+
+struct PythagorasTreeBuffers
+{
+	PythagorasSquare* squares;
+	PythagorasNodes*  last_level;
+	int               root_iter;
+	size_t            root_index;
+};
+
+size_t pythagorasTreeSize(const int iters)
+{
+	return (static_cast<size_t>(1) << iters) - 1;
+}
+
+struct PythagorasTurn
+{
+	float left_angle;
+	float right_angle;
+	float cos_angle;
+	float sin_angle;
+};
+
+PythagorasTurn pythagorasTurn(const float angle, const int iter, const bool reversing)
+{
+	const float child_angle = iter == 1 || !reversing ? angle : 90.f - angle;
+
+	PythagorasTurn turn;
+	turn.left_angle = child_angle;
+	turn.right_angle = child_angle - 90.f;
+	turn.cos_angle = glm::cos(glm::radians(child_angle));
+	turn.sin_angle = glm::sin(glm::radians(child_angle));
+
+	return turn;
+}
+
+void _genPythagorasChildren(const PythagorasNode& parent,
+                            const PythagorasTurn& turn,
+                            const bool            is_left,
+                            PythagorasNode&       left,
+                            PythagorasNode&       right)
+{
+	// The origin of a left square is the left corner of its base and that of a right square the right one, so the
+	// children stand on the opposite side of the parent, one side length along its direction apart. Directions are
+	// turned by the cosine and sine of the level angle, which are also the side ratios of the children.
+	const float along_x = parent.direction.x * parent.side;
+	const float along_y = parent.direction.y * parent.side;
+	const float base_x = parent.origin.x - along_y;
+	const float base_y = parent.origin.y + along_x;
+
+	left.origin = is_left ? glm::vec3(base_x, base_y, 0.f) : glm::vec3(base_x - along_x, base_y - along_y, 0.f);
+	right.origin = is_left ? glm::vec3(base_x + along_x, base_y + along_y, 0.f) : glm::vec3(base_x, base_y, 0.f);
+
+	left.direction.x = parent.direction.x * turn.cos_angle - parent.direction.y * turn.sin_angle;
+	left.direction.y = parent.direction.y * turn.cos_angle + parent.direction.x * turn.sin_angle;
+	right.direction.x = parent.direction.x * turn.sin_angle + parent.direction.y * turn.cos_angle;
+	right.direction.y = parent.direction.y * turn.sin_angle - parent.direction.x * turn.cos_angle;
+
+	left.abs_angle = parent.abs_angle + turn.left_angle;
+	right.abs_angle = parent.abs_angle + turn.right_angle;
+
+	left.side = parent.side * turn.cos_angle;
+	right.side = parent.side * turn.sin_angle;
+}
+
+#if defined(__AVX__)
+typedef __m256 SimdFloat;
+const size_t simd_width = 8;
+
+inline SimdFloat simdLoad(const float* p)                 { return _mm256_load_ps(p); }
+inline SimdFloat simdLoadUnaligned(const float* p)        { return _mm256_loadu_ps(p); }
+inline SimdFloat simdSet(const float f)                   { return _mm256_set1_ps(f); }
+inline SimdFloat simdAdd(const SimdFloat a, const SimdFloat b) { return _mm256_add_ps(a, b); }
+inline SimdFloat simdSub(const SimdFloat a, const SimdFloat b) { return _mm256_sub_ps(a, b); }
+inline SimdFloat simdMul(const SimdFloat a, const SimdFloat b) { return _mm256_mul_ps(a, b); }
+inline void      simdStore(float* p, const SimdFloat a)   { _mm256_store_ps(p, a); }
+inline void      simdStoreUnaligned(float* p, const SimdFloat a) { _mm256_storeu_ps(p, a); }
+
+inline void simdInterleave(const SimdFloat a, const SimdFloat b, SimdFloat& low, SimdFloat& high)
+{
+	// Unpacking works within the 128-bit halves, which are put back in order afterwards.
+	const __m256 first = _mm256_unpacklo_ps(a, b);
+	const __m256 second = _mm256_unpackhi_ps(a, b);
+	low = _mm256_permute2f128_ps(first, second, 0x20);
+	high = _mm256_permute2f128_ps(first, second, 0x31);
+}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+typedef __m128 SimdFloat;
+const size_t simd_width = 4;
+
+inline SimdFloat simdLoad(const float* p)                 { return _mm_load_ps(p); }
+inline SimdFloat simdLoadUnaligned(const float* p)        { return _mm_loadu_ps(p); }
+inline SimdFloat simdSet(const float f)                   { return _mm_set1_ps(f); }
+inline SimdFloat simdAdd(const SimdFloat a, const SimdFloat b) { return _mm_add_ps(a, b); }
+inline SimdFloat simdSub(const SimdFloat a, const SimdFloat b) { return _mm_sub_ps(a, b); }
+inline SimdFloat simdMul(const SimdFloat a, const SimdFloat b) { return _mm_mul_ps(a, b); }
+inline void      simdStore(float* p, const SimdFloat a)   { _mm_store_ps(p, a); }
+inline void      simdStoreUnaligned(float* p, const SimdFloat a) { _mm_storeu_ps(p, a); }
+
+inline void simdInterleave(const SimdFloat a, const SimdFloat b, SimdFloat& low, SimdFloat& high)
+{
+	low = _mm_unpacklo_ps(a, b);
+	high = _mm_unpackhi_ps(a, b);
+}
+#else
+typedef float SimdFloat;
+const size_t simd_width = 1;
+
+inline SimdFloat simdLoad(const float* p)                 { return *p; }
+inline SimdFloat simdLoadUnaligned(const float* p)        { return *p; }
+inline SimdFloat simdSet(const float f)                   { return f; }
+inline SimdFloat simdAdd(const SimdFloat a, const SimdFloat b) { return a + b; }
+inline SimdFloat simdSub(const SimdFloat a, const SimdFloat b) { return a - b; }
+inline SimdFloat simdMul(const SimdFloat a, const SimdFloat b) { return a * b; }
+inline void      simdStore(float* p, const SimdFloat a)   { *p = a; }
+inline void      simdStoreUnaligned(float* p, const SimdFloat a) { *p = a; }
+
+inline void simdInterleave(const SimdFloat a, const SimdFloat b, SimdFloat& low, SimdFloat& high)
+{
+	low = a;
+	high = b;
+}
+#endif
+
+float pythagorasLevelAngle(const float angle, const int iter, const bool reversing)
+{
+	float level_angle = angle;
+	if (reversing)
+	{
+		for (int i = 2; i < iter; i++)
+			level_angle = 90.f - level_angle;
+	}
+
+	return level_angle;
+}
+
+void _genPythagorasLevel(const PythagorasNodes&       nodes,
+                         const size_t                 count,
+                         const int                    iter,
+                         const size_t                 level_index,
+                         const PythagorasTreeBuffers& buffers)
+{
+	// The buffers hold the subtree of square root_index of level root_iter, which is the whole tree for 1 and 0.
+	const int root_levels = iter - buffers.root_iter;
+	const size_t first = pythagorasTreeSize(root_levels) + level_index - (buffers.root_index << root_levels);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		PythagorasSquare& square = buffers.squares[first + i];
+		square.x = nodes.x[i];
+		square.y = nodes.y[i];
+		square.rotation = iter == 1 || (level_index + i) % 2 == 0 ? nodes.abs_angle[i] : nodes.abs_angle[i] + 90.f;
+		square.side = nodes.side[i];
+		square.iter = iter;
+	}
+}
+
+void _expandPythagorasLevel(PythagorasNodes& nodes,
+                            const size_t     count,
+                            const float      angle,
+                            const int        iter,
+                            const size_t     level_index,
+                            const bool       reversing)
+{
+	// Same arithmetic as _genPythagorasChildren on simd_width parents at once. A lane adds the parent side along
+	// its direction to one child or the other, weighted by whether the parent is a left square, at an even place.
+	const PythagorasTurn turn = pythagorasTurn(angle, iter, reversing);
+
+	alignas(32) float left_weights[2][simd_width];
+	for (size_t parity = 0; parity < 2; parity++)
+	{
+		for (size_t lane = 0; lane < simd_width; lane++)
+			left_weights[parity][lane] = iter == 1 || (level_index + parity + lane) % 2 == 0 ? 1.f : 0.f;
+	}
+
+	const SimdFloat one = simdSet(1.f);
+	const SimdFloat cos_angle = simdSet(turn.cos_angle);
+	const SimdFloat sin_angle = simdSet(turn.sin_angle);
+	const SimdFloat left_angle = simdSet(turn.left_angle);
+	const SimdFloat right_angle = simdSet(turn.right_angle);
+
+	float* const fields[6] = { nodes.x.data(), nodes.y.data(), nodes.direction_x.data(), nodes.direction_y.data(), nodes.abs_angle.data(), nodes.side.data() };
+
+	// Expanding back to front lets the next level overwrite the parents in place. The last block of a level
+	// smaller than a multiple of simd_width repeats its last parent in the unused lanes.
+	const size_t blocks = (count + simd_width - 1) / simd_width;
+	for (size_t block = blocks; block-- > 0;)
 	{
-		std::getline(file, line);
+		const size_t first = block * simd_width;
+		const size_t lanes = std::min(simd_width, count - first);
+
+		SimdFloat parent[6];
+		for (int field = 0; field < 6; field++)
+		{
+			if (lanes == simd_width)
+			{
+				parent[field] = simdLoadUnaligned(&fields[field][first]);
+			}
+			else
+			{
+				alignas(32) float tail[simd_width];
+				for (size_t lane = 0; lane < simd_width; lane++)
+					tail[lane] = fields[field][first + std::min(lane, lanes - 1)];
+				parent[field] = simdLoad(tail);
+			}
+		}
+
+		const SimdFloat is_left = simdLoad(left_weights[first % 2]);
+		const SimdFloat is_right = simdSub(one, is_left);
+
+		const SimdFloat along_x = simdMul(parent[2], parent[5]);
+		const SimdFloat along_y = simdMul(parent[3], parent[5]);
+		const SimdFloat base_x = simdSub(parent[0], along_y);
+		const SimdFloat base_y = simdAdd(parent[1], along_x);
+
+		SimdFloat left[6];
+		SimdFloat right[6];
+
+		left[0] = simdSub(base_x, simdMul(along_x, is_right));
+		left[1] = simdSub(base_y, simdMul(along_y, is_right));
+		right[0] = simdAdd(base_x, simdMul(along_x, is_left));
+		right[1] = simdAdd(base_y, simdMul(along_y, is_left));
+
+		left[2] = simdSub(simdMul(parent[2], cos_angle), simdMul(parent[3], sin_angle));
+		left[3] = simdAdd(simdMul(parent[3], cos_angle), simdMul(parent[2], sin_angle));
+		right[2] = simdAdd(simdMul(parent[2], sin_angle), simdMul(parent[3], cos_angle));
+		right[3] = simdSub(simdMul(parent[3], sin_angle), simdMul(parent[2], cos_angle));
+
+		left[4] = simdAdd(parent[4], left_angle);
+		right[4] = simdAdd(parent[4], right_angle);
+
+		left[5] = simdMul(parent[5], cos_angle);
+		right[5] = simdMul(parent[5], sin_angle);
+
+		// Children of parent i go to 2i and 2i + 1.
+		for (int field = 0; field < 6; field++)
+		{
+			SimdFloat low;
+			SimdFloat high;
+			simdInterleave(left[field], right[field], low, high);
+
+			if (lanes == simd_width)
+			{
+				simdStoreUnaligned(&fields[field][2 * first], low);
+				simdStoreUnaligned(&fields[field][2 * first + simd_width], high);
+			}
+			else
+			{
+				alignas(32) float tail[2 * simd_width];
+				simdStore(tail, low);
+				simdStore(tail + simd_width, high);
+				std::copy(tail, tail + 2 * lanes, &fields[field][2 * first]);
+			}
+		}
 	}
+}
+
+void _genPythagorasSubtree(const PythagorasNode& root,
+                           const int             root_iter,
+                           const size_t          root_index,
+                           const int             last_iter,
+                           const float           angle,
+                           const bool            reversing,
+                           PythagorasNodes&             nodes,
+                           const PythagorasTreeBuffers& buffers)
+{
+	// Squares are laid out level by level; square i of a level has its children at 2i and 2i + 1 of the next one,
+	// so the squares of a subtree occupy one contiguous range per level.
+	resizePythagorasNodes(nodes, static_cast<size_t>(1) << (last_iter - root_iter));
+	storePythagorasNode(nodes, 0, root);
+
+	float level_angle = angle;
+
+	for (int iter = root_iter; iter <= last_iter; iter++)
+	{
+		const size_t level_size = static_cast<size_t>(1) << (iter - root_iter);
+		const size_t level_index = root_index << (iter - root_iter);
+
+		_genPythagorasLevel(nodes, level_size, iter, level_index, buffers);
+
+		if (iter == last_iter)
+		{
+			if (buffers.last_level != NULL)
+			{
+				for (size_t i = 0; i < level_size; i++)
+					storePythagorasNode(*buffers.last_level, level_index + i, loadPythagorasNode(nodes, i));
+			}
+			break;
+		}
+
+		_expandPythagorasLevel(nodes, level_size, level_angle, iter, level_index, reversing);
+
+		if (iter != 1 && reversing)
+			level_angle = 90.f - level_angle;
+	}
+}
+
+class WorkStealingPool
+{
+public:
+	explicit WorkStealingPool(const unsigned int threads);
+	~WorkStealingPool();
+
+	void submit(const std::function<void()>& task);
+	void wait();
+
+private:
+	struct Queue
+	{
+		std::mutex                        mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	bool pop(const unsigned int worker, std::function<void()>& task);
+	void run(const unsigned int worker);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread>            workers;
+	std::mutex                          mutex;
+	std::condition_variable             task_added;
+	std::condition_variable             tasks_done;
+	size_t                              pending;
+	size_t                              queued;
+	unsigned int                        next_queue;
+	bool                                is_stopping;
+};
+
+WorkStealingPool::WorkStealingPool(const unsigned int threads)
+	: pending(0), queued(0), next_queue(0), is_stopping(false)
+{
+	for (unsigned int i = 0; i < threads; i++)
+		queues.push_back(std::unique_ptr<Queue>(new Queue));
+
+	for (unsigned int i = 0; i < threads; i++)
+		workers.push_back(std::thread(&WorkStealingPool::run, this, i));
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_stopping = true;
+	}
+	task_added.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void WorkStealingPool::submit(const std::function<void()>& task)
+{
+	{
+		// The task is queued and counted under the same lock, so a waiting worker cannot miss it.
+		std::lock_guard<std::mutex> lock(mutex);
+		pending++;
+		queued++;
+
+		Queue& queue = *queues[next_queue];
+		next_queue = (next_queue + 1) % queues.size();
+
+		std::lock_guard<std::mutex> queue_lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+	task_added.notify_one();
+}
+
+void WorkStealingPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	tasks_done.wait(lock, [this] { return pending == 0; });
+}
+
+bool WorkStealingPool::pop(const unsigned int worker, std::function<void()>& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+		if (!queues[worker]->tasks.empty())
+		{
+			task = queues[worker]->tasks.back();
+			queues[worker]->tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < queues.size(); i++)
+	{
+		Queue& victim = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void WorkStealingPool::run(const unsigned int worker)
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			task_added.wait(lock, [this] { return queued != 0 || is_stopping; });
+			if (queued == 0)
+				return;
+			queued--;
+		}
+
+		// The claimed task stays in one of the queues until it is popped, so this only repeats while other workers steal.
+		std::function<void()> task;
+		while (!pop(worker, task))
+			std::this_thread::yield();
+
+		task();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pending == 0)
+			tasks_done.notify_all();
+	}
+}
+
+unsigned int generationThreads(const unsigned int threads)
+{
+	if (threads != 0)
+		return threads;
+
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool isValidPythagorasTree(const GLfloat side, const float angle, const int iters)
+{
+	return side > 0.f && angle > 0.f && angle < 90.f && iters > 0 && iters <= max_pythagoras_iters;
+}
+
+bool checkPythagorasTreeArguments(const GLfloat side, const float angle, const int iters)
+{
+	if (!isValidPythagorasTree(side, angle, iters))
+	{
+		std::cerr << "Wrong Pythagoras Tree function argument(s)" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void _genPythagorasTree(const GLfloat                side,
+                        const float                  angle,
+                        const int                    iters,
+                        const bool                   reversing,
+                        const unsigned int           threads,
+                        const PythagorasTreeBuffers& buffers)
+{
+	const PythagorasNode root = pythagorasRootNode(side);
+
+	PythagorasNodes nodes;
+
+	const unsigned int workers = generationThreads(threads);
+
+	// Every subtree below split_iter becomes a task; eight per worker leaves room for stealing.
+	int split_iter = 1;
+	while (split_iter < iters && (static_cast<size_t>(1) << (split_iter - 1)) < 8 * static_cast<size_t>(workers))
+		split_iter++;
+
+	if (workers == 1 || split_iter >= iters)
+	{
+		_genPythagorasSubtree(root, 1, 0, iters, angle, reversing, nodes, buffers);
+		return;
+	}
+
+	PythagorasTreeBuffers prefix_buffers = buffers;
+	prefix_buffers.last_level = NULL;
+	_genPythagorasSubtree(root, 1, 0, split_iter - 1, angle, reversing, nodes, prefix_buffers);
+
+	const size_t subtrees = static_cast<size_t>(1) << (split_iter - 1);
+	const float split_angle = pythagorasLevelAngle(angle, split_iter, reversing);
+
+	resizePythagorasNodes(nodes, subtrees);
+	_expandPythagorasLevel(nodes, subtrees / 2, pythagorasLevelAngle(angle, split_iter - 1, reversing), split_iter - 1, 0, reversing);
+
+	WorkStealingPool pool(workers);
+
+	for (size_t i = 0; i < subtrees; i++)
+	{
+		const PythagorasNode subtree_root = loadPythagorasNode(nodes, i);
+		pool.submit([=, &buffers]
+		{
+			PythagorasNodes subtree_nodes;
+			_genPythagorasSubtree(subtree_root, split_iter, i, iters, split_angle, reversing, subtree_nodes, buffers);
+		});
+	}
+
+	pool.wait();
+}
+
+bool genPythagorasSquares(const GLfloat                  side,
+                          const float                    angle,
+                          const int                      iters,
+                          const bool                     reversing,
+                          const unsigned int             threads,
+                          std::vector<PythagorasSquare>& squares,
+                          PythagorasNodes*               last_level)
+{
+	if (!checkPythagorasTreeArguments(side, angle, iters))
+		return false;
+
+	squares.resize(pythagorasTreeSize(iters));
+	if (last_level != NULL)
+		resizePythagorasNodes(*last_level, static_cast<size_t>(1) << (iters - 1));
+
+	PythagorasTreeBuffers buffers = { squares.data(), last_level, 1, 0 };
+	_genPythagorasTree(side, angle, iters, reversing, threads, buffers);
+
+	return true;
+}
+
+bool appendPythagorasLevel(const GLfloat                  side,
+                           const float                    angle,
+                           const int                      iters,
+                           const bool                     reversing,
+                           const unsigned int             threads,
+                           std::vector<PythagorasSquare>& squares,
+                           PythagorasNodes&               last_level)
+{
+	if (!checkPythagorasTreeArguments(side, angle, iters + 1))
+		return false;
+
+	const size_t count = static_cast<size_t>(1) << (iters - 1);
+	const float level_angle = pythagorasLevelAngle(angle, iters, reversing);
+
+	squares.resize(pythagorasTreeSize(iters + 1));
+	PythagorasTreeBuffers buffers = { squares.data(), NULL, 1, 0 };
+
+	const unsigned int workers = generationThreads(threads);
+	const size_t tasks = std::min(static_cast<size_t>(8) * workers, count / 4096);
+
+	if (tasks <= 1)
+	{
+		// The nodes kept from the last level are expanded in place into the next one, so the existing squares stay
+		// as they are and only the new level is generated.
+		resizePythagorasNodes(last_level, 2 * count);
+		_expandPythagorasLevel(last_level, count, level_angle, iters, 0, reversing);
+		_genPythagorasLevel(last_level, 2 * count, iters + 1, 0, buffers);
+
+		return true;
+	}
+
+	// Larger levels are split into runs of parents, each expanded by a task into its own nodes, since in place the
+	// children of one run would overwrite the parents of the next.
+	PythagorasNodes next_level;
+	resizePythagorasNodes(next_level, 2 * count);
+
+	WorkStealingPool pool(workers);
+
+	for (size_t task = 0; task < tasks; task++)
+	{
+		const size_t first = count * task / tasks;
+		const size_t last = count * (task + 1) / tasks;
+
+		pool.submit([=, &last_level, &next_level, &buffers]
+		{
+			PythagorasNodes nodes;
+			resizePythagorasNodes(nodes, 2 * (last - first));
+			for (size_t i = first; i < last; i++)
+				storePythagorasNode(nodes, i - first, loadPythagorasNode(last_level, i));
+
+			_expandPythagorasLevel(nodes, last - first, level_angle, iters, first, reversing);
+			_genPythagorasLevel(nodes, 2 * (last - first), iters + 1, 2 * first, buffers);
+
+			for (size_t i = 0; i < 2 * (last - first); i++)
+				storePythagorasNode(next_level, 2 * first + i, loadPythagorasNode(nodes, i));
+		});
+	}
+
+	pool.wait();
+	std::swap(last_level, next_level);
+
+	return true;
+}
+
+const GLuint cube_elements[12 * 3] =
+{
+	0, 1, 2,
+	0, 2, 3,
+	1, 5, 6,
+	1, 6, 2,
+	5, 4, 7,
+	5, 7, 6,
+	4, 0, 3,
+	4, 3, 7,
+	4, 5, 1,
+	4, 1, 0,
+	3, 2, 6,
+	3, 6, 7
+};
+
+glm::mat4 treeMvpMatrix(const bool       is_3d,
+                        const glm::vec3& camera_position,
+                        const glm::vec2& ortho_position,
+                        const float      ortho_x,
+                        const float      ortho_y,
+                        const float      window_ratio,
+                        const GLfloat    side)
+{
+	glm::mat4 view_matrix;
+	if (is_3d)
+		view_matrix = glm::lookAt(camera_position, glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
+	else
+		view_matrix = glm::translate(glm::vec3(-ortho_position.x, -ortho_position.y, -7.f));
+
+	glm::mat4 projection_matrix;
+	if (is_3d)
+		projection_matrix = glm::perspective(glm::radians(45.f), window_ratio, 1.f, 50.f);
+	else
+		projection_matrix = glm::ortho(-ortho_x / 2, ortho_x / 2, -ortho_y / 2, ortho_y / 2, 1.f, 50.f);
+
+	glm::mat4 model_matrix;
+	model_matrix = glm::translate(model_matrix, glm::vec3(-side / 2, -0.5f, 0.f));
+
+	return projection_matrix * view_matrix * model_matrix;
+}
+
+class ImageWriter
+{
+public:
+	ImageWriter();
+
+	bool open(const std::string& file_name, const int width, const int height);
+	bool writeRows(const unsigned char* rgb, const int rows);
+	bool close();
+
+private:
+	void writeChunk(const char type[4], const std::vector<unsigned char>& data);
+
+	std::ofstream file;
+	std::string   file_name;
+	bool          is_png;
+	bool          is_zlib_started;
+	int           width;
+	int           rows_left;
+	unsigned long adler_a;
+	unsigned long adler_b;
+};
+
+unsigned long crc32(unsigned long crc, const unsigned char* data, const size_t size)
+{
+	// A local static is initialized once even when the batch writer thread makes the first call.
+	static const std::array<unsigned long, 256> table = []
+	{
+		std::array<unsigned long, 256> entries;
+		for (unsigned long i = 0; i < 256; i++)
+		{
+			unsigned long c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320ul ^ (c >> 1) : c >> 1;
+			entries[i] = c;
+		}
+		return entries;
+	}();
+
+	crc ^= 0xfffffffful;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xfffffffful;
+}
+
+void appendBigEndian(std::vector<unsigned char>& data, const unsigned long value)
+{
+	data.push_back(static_cast<unsigned char>(value >> 24));
+	data.push_back(static_cast<unsigned char>(value >> 16));
+	data.push_back(static_cast<unsigned char>(value >> 8));
+	data.push_back(static_cast<unsigned char>(value));
+}
+
+ImageWriter::ImageWriter()
+	: is_png(false), is_zlib_started(false), width(0), rows_left(0), adler_a(1), adler_b(0)
+{
+}
+
+bool ImageWriter::open(const std::string& file_name, const int width, const int height)
+{
+	this->file_name = file_name;
+	this->width = width;
+	rows_left = height;
+	is_zlib_started = false;
+	adler_a = 1;
+	adler_b = 0;
+
+	const size_t dot = file_name.find_last_of('.');
+	const std::string extension = dot == std::string::npos ? "" : file_name.substr(dot + 1);
+	if (extension == "png" || extension == "PNG")
+		is_png = true;
+	else if (extension == "ppm" || extension == "PPM")
+		is_png = false;
+	else
+	{
+		std::cerr << "Unknown image format of " + file_name + " (use .png or .ppm)" << std::endl;
+		return false;
+	}
+
+	file.open(file_name, std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " image file" << std::endl;
+		return false;
+	}
+
+	if (!is_png)
+	{
+		file << "P6\n" << width << " " << height << "\n255\n";
+		return file.good();
+	}
+
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	std::vector<unsigned char> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	header.push_back(8);
+	header.push_back(2);
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0);
+	writeChunk("IHDR", header);
+
+	return file.good();
+}
+
+bool ImageWriter::writeRows(const unsigned char* rgb, const int rows)
+{
+	if (rows > rows_left)
+	{
+		std::cerr << "Too many rows written to " + file_name + " image file" << std::endl;
+		return false;
+	}
+	rows_left -= rows;
+
+	if (!is_png)
+	{
+		file.write(reinterpret_cast<const char*>(rgb), static_cast<std::streamsize>(rows) * width * 3);
+		return file.good();
+	}
+
+	// Rows go out as stored (uncompressed) deflate blocks, so the image can be streamed without zlib.
+	std::vector<unsigned char> scanlines;
+	scanlines.reserve(static_cast<size_t>(rows) * (width * 3 + 1));
+	for (int y = 0; y < rows; y++)
+	{
+		scanlines.push_back(0);
+		scanlines.insert(scanlines.end(), rgb + static_cast<size_t>(y) * width * 3, rgb + static_cast<size_t>(y + 1) * width * 3);
+	}
+
+	for (size_t i = 0; i < scanlines.size(); i++)
+	{
+		adler_a = (adler_a + scanlines[i]) % 65521;
+		adler_b = (adler_b + adler_a) % 65521;
+	}
+
+	std::vector<unsigned char> data;
+	if (!is_zlib_started)
+	{
+		data.push_back(0x78);
+		data.push_back(0x01);
+		is_zlib_started = true;
+	}
+
+	for (size_t i = 0; i < scanlines.size(); i += 65535)
+	{
+		const size_t size = std::min<size_t>(65535, scanlines.size() - i);
+		data.push_back(0);
+		data.push_back(static_cast<unsigned char>(size));
+		data.push_back(static_cast<unsigned char>(size >> 8));
+		data.push_back(static_cast<unsigned char>(~size));
+		data.push_back(static_cast<unsigned char>(~size >> 8));
+		data.insert(data.end(), scanlines.begin() + i, scanlines.begin() + i + size);
+	}
+	writeChunk("IDAT", data);
+
+	return file.good();
+}
+
+bool ImageWriter::close()
+{
+	if (rows_left != 0)
+	{
+		std::cerr << "Missing rows in " + file_name + " image file" << std::endl;
+		return false;
+	}
+
+	if (is_png)
+	{
+		std::vector<unsigned char> data;
+		if (!is_zlib_started)
+		{
+			data.push_back(0x78);
+			data.push_back(0x01);
+			is_zlib_started = true;
+		}
+		data.push_back(1);
+		data.push_back(0);
+		data.push_back(0);
+		data.push_back(0xff);
+		data.push_back(0xff);
+		appendBigEndian(data, (adler_b << 16) | adler_a);
+		writeChunk("IDAT", data);
+		writeChunk("IEND", std::vector<unsigned char>());
+	}
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " image file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void ImageWriter::writeChunk(const char type[4], const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> chunk;
+	appendBigEndian(chunk, static_cast<unsigned long>(data.size()));
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	appendBigEndian(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+
+	file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+struct SceneShading
+{
+	GLfloat   depth;
+	int       last_iter;
+	glm::vec3 first_color;
+	glm::vec3 last_color;
+	bool      is_directed_light;
+	glm::vec3 light_direction;
+};
+
+struct RasterVertex
+{
+	glm::vec4 position;
+	glm::vec3 normal;
+};
+
+class SoftwareRasterizer
+{
+public:
+	SoftwareRasterizer(const int width, const int height);
+
+	void clear();
+	void drawSquares(const PythagorasSquare* squares, const size_t count, const glm::mat4& mvp, const SceneShading& shading);
+
+	const std::vector<unsigned char>& getColor() const { return color; }
+
+private:
+	void drawTriangle(const RasterVertex& a, const RasterVertex& b, const RasterVertex& c, const glm::vec3& object_color, const SceneShading& shading);
+	void rasterizeTriangle(const RasterVertex v[3], const glm::vec3& object_color, const SceneShading& shading);
+
+	int                        width;
+	int                        height;
+	std::vector<float>         depth_buffer;
+	std::vector<unsigned char> color;
+};
+
+SoftwareRasterizer::SoftwareRasterizer(const int width, const int height)
+	: width(width), height(height), depth_buffer(static_cast<size_t>(width) * height), color(static_cast<size_t>(width) * height * 3)
+{
+	clear();
+}
+
+void SoftwareRasterizer::clear()
+{
+	std::fill(depth_buffer.begin(), depth_buffer.end(), 1.f);
+	std::fill(color.begin(), color.end(), 255);
+}
+
+void SoftwareRasterizer::drawSquares(const PythagorasSquare* squares, const size_t count, const glm::mat4& mvp, const SceneShading& shading)
+{
+	// Mirrors pt_vertex_shader.vert: the cube corners are built from the instance record.
+	const glm::vec2 corners[4] = { glm::vec2(0.f, 1.f), glm::vec2(1.f, 1.f), glm::vec2(1.f, 0.f), glm::vec2(0.f, 0.f) };
+	const glm::vec2 normals[4] = { glm::vec2(-1.f, 1.f), glm::vec2(1.f, 1.f), glm::vec2(1.f, -1.f), glm::vec2(-1.f, -1.f) };
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const PythagorasSquare& square = squares[i];
+
+		const float angle = glm::radians(square.rotation);
+		const float c = glm::cos(angle);
+		const float s = glm::sin(angle);
+
+		RasterVertex vertices[8];
+		for (int corner = 0; corner < 8; corner++)
+		{
+			const float face = corner < 4 ? 1.f : -1.f;
+			const glm::vec2 local = corners[corner % 4] * square.side;
+			const glm::vec2 n = normals[corner % 4];
+
+			vertices[corner].position = mvp * glm::vec4(square.x + c * local.x - s * local.y, square.y + s * local.x + c * local.y, face * shading.depth / 2.f, 1.f);
+			vertices[corner].normal = glm::vec3(c * n.x - s * n.y, s * n.x + c * n.y, face);
+		}
+
+		const float ratio = shading.last_iter > 1 ? 1.f - static_cast<float>(square.iter - 1) / (shading.last_iter - 1) : 1.f;
+		const glm::vec3 object_color = shading.last_color + (shading.first_color - shading.last_color) * ratio;
+
+		for (int j = 0; j < 12 * 3; j += 3)
+			drawTriangle(vertices[cube_elements[j]], vertices[cube_elements[j + 1]], vertices[cube_elements[j + 2]], object_color, shading);
+	}
+}
+
+void SoftwareRasterizer::drawTriangle(const RasterVertex& a, const RasterVertex& b, const RasterVertex& c, const glm::vec3& object_color, const SceneShading& shading)
+{
+	// Only the near plane needs real clipping; everything else is handled by the screen bounds and the depth range.
+	const RasterVertex input[3] = { a, b, c };
+	RasterVertex clipped[4];
+	int count = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		const RasterVertex& current = input[i];
+		const RasterVertex& next = input[(i + 1) % 3];
+		const float current_distance = current.position.z + current.position.w;
+		const float next_distance = next.position.z + next.position.w;
+
+		if (current_distance >= 0.f)
+			clipped[count++] = current;
+
+		if ((current_distance >= 0.f) != (next_distance >= 0.f))
+		{
+			const float t = current_distance / (current_distance - next_distance);
+			clipped[count].position = current.position + (next.position - current.position) * t;
+			clipped[count].normal = current.normal + (next.normal - current.normal) * t;
+			count++;
+		}
+	}
+
+	for (int i = 1; i + 1 < count; i++)
+	{
+		const RasterVertex triangle[3] = { clipped[0], clipped[i], clipped[i + 1] };
+		rasterizeTriangle(triangle, object_color, shading);
+	}
+}
+
+void SoftwareRasterizer::rasterizeTriangle(const RasterVertex v[3], const glm::vec3& object_color, const SceneShading& shading)
+{
+	float x[3];
+	float y[3];
+	float z[3];
+	float inv_w[3];
+	for (int i = 0; i < 3; i++)
+	{
+		inv_w[i] = 1.f / v[i].position.w;
+		x[i] = (v[i].position.x * inv_w[i] + 1.f) / 2.f * width;
+		y[i] = (v[i].position.y * inv_w[i] + 1.f) / 2.f * height;
+		z[i] = (v[i].position.z * inv_w[i] + 1.f) / 2.f;
+	}
+
+	// Counter-clockwise triangles are front facing and, like glCullFace(GL_FRONT), culled.
+	const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (!(area < 0.f))
+		return;
+
+	const int min_x = std::max(0, static_cast<int>(glm::floor(std::min(x[0], std::min(x[1], x[2])))));
+	const int max_x = std::min(width - 1, static_cast<int>(glm::ceil(std::max(x[0], std::max(x[1], x[2])))));
+	const int min_y = std::max(0, static_cast<int>(glm::floor(std::min(y[0], std::min(y[1], y[2])))));
+	const int max_y = std::min(height - 1, static_cast<int>(glm::ceil(std::max(y[0], std::max(y[1], y[2])))));
+
+	const glm::vec3 light_direction = glm::normalize(shading.light_direction);
+
+	for (int py = min_y; py <= max_y; py++)
+	{
+		const float sample_y = py + 0.5f;
+		for (int px = min_x; px <= max_x; px++)
+		{
+			const float sample_x = px + 0.5f;
+
+			const float b0 = ((x[1] - sample_x) * (y[2] - sample_y) - (x[2] - sample_x) * (y[1] - sample_y)) / area;
+			const float b1 = ((x[2] - sample_x) * (y[0] - sample_y) - (x[0] - sample_x) * (y[2] - sample_y)) / area;
+			const float b2 = 1.f - b0 - b1;
+			if (b0 < 0.f || b1 < 0.f || b2 < 0.f)
+				continue;
+
+			const float fragment_z = b0 * z[0] + b1 * z[1] + b2 * z[2];
+			const size_t pixel = static_cast<size_t>(height - 1 - py) * width + px;
+			if (fragment_z < 0.f || fragment_z > 1.f || !(fragment_z < depth_buffer[pixel]))
+				continue;
+			depth_buffer[pixel] = fragment_z;
+
+			glm::vec3 fragment_color = object_color;
+			if (shading.is_directed_light)
+			{
+				const float w0 = b0 * inv_w[0];
+				const float w1 = b1 * inv_w[1];
+				const float w2 = b2 * inv_w[2];
+				const glm::vec3 normal = (v[0].normal * w0 + v[1].normal * w1 + v[2].normal * w2) / (w0 + w1 + w2);
+
+				const float light_cos = -glm::dot(light_direction, glm::normalize(normal));
+				const glm::vec3 diffuse(light_cos > 0.f ? light_cos : 0.f);
+				fragment_color = object_color * 0.7f * (object_color + diffuse);
+			}
+
+			for (int i = 0; i < 3; i++)
+				color[pixel * 3 + i] = static_cast<unsigned char>(glm::clamp(fragment_color[i], 0.f, 1.f) * 255.f + 0.5f);
+		}
+	}
+}
+
+struct PythagorasMeshSquare
+{
+	glm::vec2 corners[4];
+	GLuint    points[4];
+	size_t    level_index;
+};
+
+typedef std::function<void(const glm::vec2& point, const int iter)>                 PythagorasPointCallback;
+typedef std::function<void(const PythagorasMeshSquare& square, const int iter)>     PythagorasSquareCallback;
+
+void _placePythagorasMeshSquare(const PythagorasNode& node, const bool is_left, PythagorasMeshSquare& square)
+{
+	// The corners of the square as the vertex shader places them from its origin, rotation and side; a right
+	// square is turned a quarter more than its direction.
+	const float c = is_left ? node.direction.x : -node.direction.y;
+	const float s = is_left ? node.direction.y : node.direction.x;
+
+	const float corners[4][2] =
+	{
+		{ 0.f,       node.side },
+		{ node.side, node.side },
+		{ node.side, 0.f },
+		{ 0.f,       0.f }
+	};
+
+	for (int i = 0; i < 4; i++)
+	{
+		square.corners[i].x = c * corners[i][0] - s * corners[i][1] + node.origin.x;
+		square.corners[i].y = s * corners[i][0] + c * corners[i][1] + node.origin.y;
+	}
+}
+
+void _weldPythagorasMeshSquare(PythagorasMeshSquare&              square,
+                               const float                        tolerance,
+                               const PythagorasMeshSquare* const  neighbours[],
+                               const int                          neighbours_number,
+                               const int                          iter,
+                               GLuint&                            points,
+                               const PythagorasPointCallback&     on_point)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		bool is_welded = false;
+		for (int n = 0; n < neighbours_number && !is_welded; n++)
+		{
+			for (int j = 0; j < 4 && !is_welded; j++)
+			{
+				const glm::vec2 offset = square.corners[i] - neighbours[n]->corners[j];
+				if (glm::dot(offset, offset) <= tolerance * tolerance)
+				{
+					square.points[i] = neighbours[n]->points[j];
+					is_welded = true;
+				}
+			}
+		}
+
+		if (!is_welded)
+		{
+			square.points[i] = points++;
+			if (on_point)
+				on_point(square.corners[i], iter);
+		}
+	}
+}
+
+void _walkPythagorasMesh(const PythagorasNode&           node,
+                         const PythagorasMeshSquare&     square,
+                         const int                       iter,
+                         const bool                      is_left,
+                         const float                     angle,
+                         const int                       iters,
+                         const bool                      reversing,
+                         GLuint&                         points,
+                         const PythagorasPointCallback&  on_point,
+                         const PythagorasSquareCallback& on_square)
+{
+	if (on_square)
+		on_square(square, iter);
+
+	if (iter == iters)
+		return;
+
+	PythagorasNode left;
+	PythagorasNode right;
+	_genPythagorasChildren(node, pythagorasTurn(angle, iter, reversing), is_left, left, right);
+
+	// Children share their base corners with the parent and the corner between them with each other. Other corners
+	// are at least the smaller child side apart, while rounding moves the shared ones far less unless that side is
+	// near the float resolution, where the squares are degenerate anyway.
+	const float tolerance = 0.25f * glm::min(left.side, right.side);
+
+	PythagorasMeshSquare left_square;
+	_placePythagorasMeshSquare(left, true, left_square);
+	left_square.level_index = 2 * square.level_index;
+	const PythagorasMeshSquare* const left_neighbours[1] = { &square };
+	_weldPythagorasMeshSquare(left_square, tolerance, left_neighbours, 1, iter + 1, points, on_point);
+
+	PythagorasMeshSquare right_square;
+	_placePythagorasMeshSquare(right, false, right_square);
+	right_square.level_index = 2 * square.level_index + 1;
+	const PythagorasMeshSquare* const right_neighbours[2] = { &square, &left_square };
+	_weldPythagorasMeshSquare(right_square, tolerance, right_neighbours, 2, iter + 1, points, on_point);
+
+	const float child_angle = iter != 1 && reversing ? 90.f - angle : angle;
+	_walkPythagorasMesh(left, left_square, iter + 1, true, child_angle, iters, reversing, points, on_point, on_square);
+	_walkPythagorasMesh(right, right_square, iter + 1, false, child_angle, iters, reversing, points, on_point, on_square);
+}
+
+GLuint walkPythagorasMesh(const GLfloat                   side,
+                          const float                     angle,
+                          const int                       iters,
+                          const bool                      reversing,
+                          const PythagorasPointCallback&  on_point,
+                          const PythagorasSquareCallback& on_square)
+{
+	// Depth first, so only one square per level is alive; the welding is deterministic and every walk
+	// numbers the points the same way.
+	const PythagorasNode root = pythagorasRootNode(side);
+
+	PythagorasMeshSquare square;
+	_placePythagorasMeshSquare(root, true, square);
+	square.level_index = 0;
+
+	GLuint points = 0;
+	_weldPythagorasMeshSquare(square, 0.f, NULL, 0, 1, points, on_point);
+	_walkPythagorasMesh(root, square, 1, true, angle, iters, reversing, points, on_point, on_square);
+
+	return points;
+}
+
+struct PythagorasMesh
+{
+	std::vector<GLfloat>  points;
+	std::vector<GLushort> short_corners;
+	std::vector<GLuint>   corners;
+	std::vector<GLubyte>  iters;
+};
+
+bool genPythagorasMesh(const GLfloat   side,
+                       const float     angle,
+                       const int       iters,
+                       const bool      reversing,
+                       PythagorasMesh& mesh)
+{
+	if (!checkPythagorasTreeArguments(side, angle, iters))
+		return false;
+
+	// Squares keep the indices of their four welded corners. Depth and normals follow from the corners in the
+	// vertex shader, so a square costs its indices, its iteration and about two and a half points. Squares are
+	// stored level by level like genPythagorasSquares, so overlapping squares are drawn in the same order.
+	const size_t squares = pythagorasTreeSize(iters);
+	if (squares > 0xfffffffful / 4)
+	{
+		std::cerr << "Too many iterations for compact mesh" << std::endl;
+		return false;
+	}
+
+	const bool is_short = 4 * squares <= 65536;
+
+	mesh.points.clear();
+	mesh.short_corners.clear();
+	mesh.corners.clear();
+
+	mesh.points.reserve(2 * (4 + 5 * (squares / 2)));
+	mesh.iters.resize(squares);
+	if (is_short)
+		mesh.short_corners.resize(4 * squares);
+	else
+		mesh.corners.resize(4 * squares);
+
+	walkPythagorasMesh(side, angle, iters, reversing, [&](const glm::vec2& point, const int)
+	{
+		mesh.points.push_back(point.x);
+		mesh.points.push_back(point.y);
+	}, [&](const PythagorasMeshSquare& square, const int iter)
+	{
+		const size_t i = pythagorasTreeSize(iter - 1) + square.level_index;
+		for (int corner = 0; corner < 4; corner++)
+		{
+			if (is_short)
+				mesh.short_corners[4 * i + corner] = static_cast<GLushort>(square.points[corner]);
+			else
+				mesh.corners[4 * i + corner] = square.points[corner];
+		}
+		mesh.iters[i] = static_cast<GLubyte>(iter);
+	});
+
+	return true;
+}
+
+glm::vec4 pythagorasSubtreeBounds(const PythagorasSquare& root, const bool is_left, const float angle, const int iters, const bool reversing)
+{
+	// Right children are kept turned by 90 degrees from the base their children stand on, with the origin in the
+	// right end of that base.
+	const double root_rotation = is_left ? root.rotation : root.rotation - 90.0;
+	glm::dvec2 origin(root.x, root.y);
+	if (!is_left)
+		origin -= static_cast<double>(root.side) * glm::dvec2(std::cos(glm::radians(root_rotation)), std::sin(glm::radians(root_rotation)));
+
+	// Every child is turned by its level angle, and a right child by another -90 degrees, so the squares of a level
+	// only face four directions 90 degrees apart relative to any axis. How far each subtree of a level reaches along
+	// those directions, in units of its root side from its root origin, follows from the level below in O(iters).
+	const int levels = iters - root.iter + 1;
+	std::vector<double> base_angles(levels);
+	base_angles[0] = glm::radians(-root_rotation);
+	for (int level = 1; level < levels; level++)
+		base_angles[level] = base_angles[level - 1] - glm::radians(static_cast<double>(pythagorasLevelAngle(angle, root.iter + level, reversing)));
+
+	double reach[4];
+	double child_reach[4];
+	for (int level = levels - 1; level >= 0; level--)
+	{
+		std::copy(reach, reach + 4, child_reach);
+
+		const double level_angle = glm::radians(static_cast<double>(pythagorasLevelAngle(angle, root.iter + level + 1, reversing)));
+		const double cos_angle = std::cos(level_angle);
+		const double sin_angle = std::sin(level_angle);
+
+		for (int direction = 0; direction < 4; direction++)
+		{
+			const double direction_angle = base_angles[level] + direction * glm::half_pi<double>();
+			const glm::dvec2 axis(std::cos(direction_angle), std::sin(direction_angle));
+
+			// The unit square reaches farthest with one of its corners, and the children start at its top left
+			// corner and at the apex of the triangle between them.
+			reach[direction] = glm::max(axis.x, 0.0) + glm::max(axis.y, 0.0);
+			if (level + 1 < levels)
+			{
+				const glm::dvec2 apex = glm::dvec2(0.0, 1.0) + cos_angle * glm::dvec2(cos_angle, sin_angle);
+				reach[direction] = glm::max(reach[direction], axis.y + cos_angle * child_reach[direction]);
+				reach[direction] = glm::max(reach[direction], glm::dot(apex, axis) + sin_angle * child_reach[(direction + 1) % 4]);
+			}
+		}
+	}
+
+	return glm::vec4(origin.x - root.side * reach[2], origin.y - root.side * reach[3], origin.x + root.side * reach[0], origin.y + root.side * reach[1]);
+}
+
+struct PythagorasTreeStats
+{
+	glm::vec4           bounds;
+	std::vector<size_t> level_squares;
+	std::vector<float>  level_min_sides;
+	std::vector<float>  level_max_sides;
+	double              area;
+};
+
+void analyzePythagorasTree(const GLfloat side, const float angle, const int iters, const bool reversing, PythagorasTreeStats& stats)
+{
+	const PythagorasSquare root = { 0.f, 0.f, 0.f, side, 1 };
+	stats.bounds = pythagorasSubtreeBounds(root, true, angle, iters, reversing);
+
+	stats.level_squares.resize(iters);
+	stats.level_min_sides.resize(iters);
+	stats.level_max_sides.resize(iters);
+
+	// The sides of the children are the legs of a right triangle on the side of their parent, so every level covers
+	// the area of the root, overlaps included.
+	stats.area = static_cast<double>(side) * side * iters;
+
+	double min_side = side;
+	double max_side = side;
+	for (int iter = 1; iter <= iters; iter++)
+	{
+		stats.level_squares[iter - 1] = static_cast<size_t>(1) << (iter - 1);
+		stats.level_min_sides[iter - 1] = static_cast<float>(min_side);
+		stats.level_max_sides[iter - 1] = static_cast<float>(max_side);
+
+		const double level_angle = glm::radians(static_cast<double>(pythagorasLevelAngle(angle, iter + 1, reversing)));
+		min_side *= glm::min(std::cos(level_angle), std::sin(level_angle));
+		max_side *= glm::max(std::cos(level_angle), std::sin(level_angle));
+	}
+}
+
+int pythagorasVisibleIters(const GLfloat side, const float angle, const int iters, const bool reversing, const float min_side)
+{
+	// The deepest level that still has a square of at least min_side; the root is always kept.
+	double max_side = side;
+	int visible_iters = 1;
+	while (visible_iters < iters)
+	{
+		max_side *= glm::max(glm::cos(glm::radians(pythagorasLevelAngle(angle, visible_iters + 1, reversing))),
+		                     glm::sin(glm::radians(pythagorasLevelAngle(angle, visible_iters + 1, reversing))));
+		if (max_side < min_side)
+			break;
+		visible_iters++;
+	}
+
+	return visible_iters;
+}
+
+glm::vec4 treeViewBounds(const GLfloat side, const float angle, const int iters, const bool reversing)
+{
+	// Bounds of the tree where treeMvpMatrix places it.
+	const PythagorasSquare root = { 0.f, 0.f, 0.f, side, 1 };
+	return pythagorasSubtreeBounds(root, true, angle, iters, reversing) - glm::vec4(side / 2, 0.5f, side / 2, 0.5f);
+}
+
+int visiblePythagorasIters(const glm::mat4& mvp,
+                           const glm::vec2& viewport,
+                           const float      min_pixels,
+                           const GLfloat    depth,
+                           const GLfloat    side,
+                           const float      angle,
+                           const int        iters,
+                           const bool       reversing)
+{
+	// The LOD of a tree that is not generated, as one cluster: a level is dropped when the branches it starts would
+	// be smaller than min_pixels where the tree is nearest to the camera.
+	if (min_pixels <= 0.f)
+		return iters;
+
+	const PythagorasSquare root = { 0.f, 0.f, 0.f, side, 1 };
+	const glm::vec4 bounds = pythagorasSubtreeBounds(root, true, angle, iters, reversing);
+
+	float min_w = FLT_MAX;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		const glm::vec4 clip = mvp * glm::vec4(corner & 1 ? bounds.z : bounds.x, corner & 2 ? bounds.w : bounds.y, corner & 4 ? depth * 0.5f : -depth * 0.5f, 1.f);
+		min_w = glm::min(min_w, clip.w);
+	}
+
+	if (min_w <= 0.f)
+		return iters;
+
+	const float pixels_per_unit = 0.5f * glm::max(glm::length(glm::vec3(mvp[0][0], mvp[1][0], mvp[2][0])) * viewport.x,
+	                                              glm::length(glm::vec3(mvp[0][1], mvp[1][1], mvp[2][1])) * viewport.y);
+	const float subtree_scale = glm::max(bounds.z - bounds.x, bounds.w - bounds.y) / side;
+
+	return pythagorasVisibleIters(side, angle, iters, reversing, min_pixels * min_w / (subtree_scale * pixels_per_unit));
+}
+
+struct PythagorasIndexNode
+{
+	glm::dvec2 origin;
+	glm::dvec2 direction;
+	double     side;
+	int        iter;
+	size_t     position;
+};
+
+struct PythagorasSpatialIndex
+{
+	int                 iters;
+	glm::dvec2          turns[2];
+	std::vector<double> reaches;
+	PythagorasIndexNode root;
+};
+
+struct PythagorasHit
+{
+	PythagorasIndexNode node;
+	double              distance;
+};
+
+typedef std::function<void(const PythagorasIndexNode& node)> PythagorasNodeCallback;
+
+void buildPythagorasSpatialIndex(const GLfloat side, const float angle, const int iters, const bool reversing, PythagorasSpatialIndex& index)
+{
+	// The tree is its own bounding volume hierarchy: every subtree is a turned and scaled copy of the tree from its
+	// level down, so it stays within one reach per level of the corner its square stands on, and nothing per square
+	// has to be stored. Squares are walked with their corner, base direction and side.
+	index.iters = iters;
+	for (int i = 0; i < 2; i++)
+	{
+		const double turn_angle = glm::radians(static_cast<double>(pythagorasLevelAngle(angle, 2 + i, reversing)));
+		index.turns[i] = glm::dvec2(std::cos(turn_angle), std::sin(turn_angle));
+	}
+
+	index.reaches.assign(iters + 1, 0.0);
+	for (int iter = 1; iter <= iters; iter++)
+	{
+		const PythagorasSquare root = { 0.f, 0.f, 0.f, 1.f, iter };
+		const glm::dvec4 bounds(pythagorasSubtreeBounds(root, true, angle, iters, reversing));
+		index.reaches[iter] = glm::max(glm::max(glm::length(glm::dvec2(bounds.x, bounds.y)), glm::length(glm::dvec2(bounds.z, bounds.y))),
+		                               glm::max(glm::length(glm::dvec2(bounds.x, bounds.w)), glm::length(glm::dvec2(bounds.z, bounds.w)))) * 1.001;
+	}
+
+	index.root.origin = glm::dvec2(0.0, 0.0);
+	index.root.direction = glm::dvec2(1.0, 0.0);
+	index.root.side = side;
+	index.root.iter = 1;
+	index.root.position = 0;
+}
+
+void childPythagorasIndexNodes(const PythagorasSpatialIndex& index, const PythagorasIndexNode& node, PythagorasIndexNode children[2])
+{
+	const glm::dvec2 turn = index.turns[(node.iter + 1) % 2];
+	const glm::dvec2 normal(-node.direction.y, node.direction.x);
+
+	children[0].origin = node.origin + normal * node.side;
+	children[0].direction = glm::dvec2(node.direction.x * turn.x - node.direction.y * turn.y, node.direction.x * turn.y + node.direction.y * turn.x);
+	children[0].side = node.side * turn.x;
+	children[1].origin = children[0].origin + children[0].direction * children[0].side;
+	children[1].direction = glm::dvec2(children[0].direction.y, -children[0].direction.x);
+	children[1].side = node.side * turn.y;
+
+	for (int i = 0; i < 2; i++)
+	{
+		children[i].iter = node.iter + 1;
+		children[i].position = 2 * node.position + i;
+	}
+}
+
+size_t pythagorasNodeIndex(const PythagorasIndexNode& node)
+{
+	// Level order index of the square in the generated tree.
+	return pythagorasTreeSize(node.iter - 1) + node.position;
+}
+
+std::string pythagorasNodePath(const PythagorasIndexNode& node)
+{
+	// Left and right turns from the root, which are the bits of the position within the level.
+	std::string path;
+	for (int bit = node.iter - 2; bit >= 0; bit--)
+		path += (node.position >> bit) & 1 ? 'R' : 'L';
+
+	return path.empty() ? "root" : path;
+}
+
+glm::dvec2 pythagorasNodeCenter(const PythagorasIndexNode& node)
+{
+	const glm::dvec2 normal(-node.direction.y, node.direction.x);
+	return node.origin + (node.direction + normal) * (node.side / 2.0);
+}
+
+std::string describePythagorasNode(const PythagorasIndexNode& node, const GLfloat side)
+{
+	// The center is given where treeMvpMatrix places the tree.
+	const glm::dvec2 center = pythagorasNodeCenter(node) - glm::dvec2(side / 2.0, 0.5);
+
+	std::stringstream sstream;
+	sstream << "Square " << pythagorasNodeIndex(node) << ": iteration " << node.iter << ", path " << pythagorasNodePath(node) << ", side " << node.side
+	        << ", center " << center.x << ", " << center.y;
+
+	return sstream.str();
+}
+
+double _pythagorasNodeDistance(const PythagorasIndexNode& node, const glm::dvec2& point)
+{
+	const glm::dvec2 normal(-node.direction.y, node.direction.x);
+	const glm::dvec2 local(glm::dot(point - node.origin, node.direction), glm::dot(point - node.origin, normal));
+	return glm::length(local - glm::clamp(local, glm::dvec2(0.0), glm::dvec2(node.side)));
+}
+
+bool _isPythagorasHitBetter(const double distance, const PythagorasIndexNode& node, const PythagorasHit& hit)
+{
+	// At the same distance the square drawn first wins, like the depth test does.
+	if (distance != hit.distance)
+		return distance < hit.distance;
+
+	return node.iter != hit.node.iter ? node.iter < hit.node.iter : node.position < hit.node.position;
+}
+
+void _pickPythagorasNode(const PythagorasSpatialIndex& index,
+                         const PythagorasIndexNode&    node,
+                         const glm::dvec3&             ray_origin,
+                         const glm::dvec3&             ray_direction,
+                         const double                  first_t,
+                         const double                  last_t,
+                         const double                  half_depth,
+                         PythagorasHit&                hit)
+{
+	// Within the slab of the squares the ray covers a segment in the plane of the tree, which has to come within
+	// the reach of the subtree.
+	const double end_t = glm::min(last_t, hit.distance);
+	if (first_t > end_t)
+		return;
+
+	const glm::dvec2 start = glm::dvec2(ray_origin) + glm::dvec2(ray_direction) * first_t;
+	const glm::dvec2 segment = glm::dvec2(ray_direction) * (end_t - first_t);
+	const double length_squared = glm::dot(segment, segment);
+	const double ratio = length_squared > 0.0 ? glm::clamp(glm::dot(node.origin - start, segment) / length_squared, 0.0, 1.0) : 0.0;
+	if (glm::length(start + segment * ratio - node.origin) > index.reaches[node.iter] * node.side)
+		return;
+
+	// Slab test of the ray against the box of the square.
+	const glm::dvec2 normal(-node.direction.y, node.direction.x);
+	const glm::dvec3 local_origin(glm::dot(glm::dvec2(ray_origin) - node.origin, node.direction), glm::dot(glm::dvec2(ray_origin) - node.origin, normal),
+	                              ray_origin.z);
+	const glm::dvec3 local_direction(glm::dot(glm::dvec2(ray_direction), node.direction), glm::dot(glm::dvec2(ray_direction), normal), ray_direction.z);
+	const glm::dvec3 box_min(0.0, 0.0, -half_depth);
+	const glm::dvec3 box_max(node.side, node.side, half_depth);
+
+	double enter_t = first_t;
+	double exit_t = last_t;
+	for (int axis = 0; axis < 3 && enter_t <= exit_t; axis++)
+	{
+		if (local_direction[axis] == 0.0)
+		{
+			if (local_origin[axis] < box_min[axis] || local_origin[axis] > box_max[axis])
+				exit_t = -1.0;
+			continue;
+		}
+
+		const double near_t = (box_min[axis] - local_origin[axis]) / local_direction[axis];
+		const double far_t = (box_max[axis] - local_origin[axis]) / local_direction[axis];
+		enter_t = glm::max(enter_t, glm::min(near_t, far_t));
+		exit_t = glm::min(exit_t, glm::max(near_t, far_t));
+	}
+
+	if (enter_t <= exit_t && _isPythagorasHitBetter(enter_t, node, hit))
+	{
+		hit.node = node;
+		hit.distance = enter_t;
+	}
+
+	if (node.iter == index.iters)
+		return;
+
+	PythagorasIndexNode children[2];
+	childPythagorasIndexNodes(index, node, children);
+	for (int i = 0; i < 2; i++)
+		_pickPythagorasNode(index, children[i], ray_origin, ray_direction, first_t, last_t, half_depth, hit);
+}
+
+bool pickPythagorasSquare(const PythagorasSpatialIndex& index,
+                          const glm::dvec3&             ray_origin,
+                          const glm::dvec3&             ray_direction,
+                          const GLfloat                 depth,
+                          PythagorasHit&                hit)
+{
+	// The first square box on the ray in model coordinates, at the distance in ray direction lengths.
+	const double half_depth = depth / 2.0;
+	double first_t = 0.0;
+	double last_t = DBL_MAX;
+	if (ray_direction.z != 0.0)
+	{
+		const double top_t = (half_depth - ray_origin.z) / ray_direction.z;
+		const double bottom_t = (-half_depth - ray_origin.z) / ray_direction.z;
+		first_t = glm::max(first_t, glm::min(top_t, bottom_t));
+		last_t = glm::max(top_t, bottom_t);
+	}
+	else if (glm::abs(ray_origin.z) > half_depth)
+		return false;
+
+	hit.distance = DBL_MAX;
+	_pickPythagorasNode(index, index.root, ray_origin, ray_direction, first_t, last_t, half_depth, hit);
+
+	return hit.distance != DBL_MAX;
+}
+
+void _nearestPythagorasNode(const PythagorasSpatialIndex& index, const PythagorasIndexNode& node, const glm::dvec2& point, PythagorasHit& hit)
+{
+	const double reach_distance = glm::max(glm::length(point - node.origin) - index.reaches[node.iter] * node.side, 0.0);
+	if (reach_distance > hit.distance || (reach_distance == hit.distance && hit.node.iter < node.iter))
+		return;
+
+	const double distance = _pythagorasNodeDistance(node, point);
+	if (_isPythagorasHitBetter(distance, node, hit))
+	{
+		hit.node = node;
+		hit.distance = distance;
+	}
+
+	if (node.iter == index.iters)
+		return;
+
+	// The nearer child goes first, so the bound is tight when the farther one is checked.
+	PythagorasIndexNode children[2];
+	childPythagorasIndexNodes(index, node, children);
+	const int first = glm::length(point - pythagorasNodeCenter(children[0])) <= glm::length(point - pythagorasNodeCenter(children[1])) ? 0 : 1;
+	_nearestPythagorasNode(index, children[first], point, hit);
+	_nearestPythagorasNode(index, children[1 - first], point, hit);
+}
+
+void nearestPythagorasSquare(const PythagorasSpatialIndex& index, const glm::dvec2& point, PythagorasHit& hit)
+{
+	// The square closest to the point in the plane of the tree, at distance 0 the lowest one containing it.
+	hit.node = index.root;
+	hit.distance = DBL_MAX;
+	_nearestPythagorasNode(index, index.root, point, hit);
+}
+
+void _queryPythagorasNode(const PythagorasSpatialIndex& index,
+                          const PythagorasIndexNode&    node,
+                          const glm::dvec2&             min,
+                          const glm::dvec2&             max,
+                          const PythagorasNodeCallback& on_square)
+{
+	const double reach = index.reaches[node.iter] * node.side;
+	if (glm::length(node.origin - glm::clamp(node.origin, min, max)) > reach)
+		return;
+
+	// Separating axis test of the square against the rectangle, along the axes of both.
+	const glm::dvec2 normal(-node.direction.y, node.direction.x);
+	const glm::dvec2 corners[4] = { node.origin, node.origin + node.direction * node.side, node.origin + (node.direction + normal) * node.side,
+	                                node.origin + normal * node.side };
+
+	glm::dvec2 square_min = corners[0];
+	glm::dvec2 square_max = corners[0];
+	for (int i = 1; i < 4; i++)
+	{
+		square_min = glm::min(square_min, corners[i]);
+		square_max = glm::max(square_max, corners[i]);
+	}
+
+	bool is_overlapping = square_min.x <= max.x && square_max.x >= min.x && square_min.y <= max.y && square_max.y >= min.y;
+	for (int axis = 0; axis < 2 && is_overlapping; axis++)
+	{
+		const glm::dvec2 direction = axis == 0 ? node.direction : normal;
+		double low = DBL_MAX;
+		double high = -DBL_MAX;
+		for (int i = 0; i < 4; i++)
+		{
+			const double projection = glm::dot(glm::dvec2(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y) - node.origin, direction);
+			low = glm::min(low, projection);
+			high = glm::max(high, projection);
+		}
+		is_overlapping = low <= node.side && high >= 0.0;
+	}
+
+	if (is_overlapping)
+		on_square(node);
+
+	if (node.iter == index.iters)
+		return;
+
+	PythagorasIndexNode children[2];
+	childPythagorasIndexNodes(index, node, children);
+	for (int i = 0; i < 2; i++)
+		_queryPythagorasNode(index, children[i], min, max, on_square);
+}
+
+void queryPythagorasSquares(const PythagorasSpatialIndex& index, const glm::dvec2& min, const glm::dvec2& max, const PythagorasNodeCallback& on_square)
+{
+	// Every square overlapping the rectangle, depth first.
+	_queryPythagorasNode(index, index.root, min, max, on_square);
+}
+
+struct PythagorasTreeLod
+{
+	int                    iters;
+	int                    cluster_iter;
+	std::vector<glm::vec4> bounds;
+	std::vector<float>     max_sides;
+	std::vector<int>       last_iters;
+};
+
+struct PythagorasRange
+{
+	size_t first;
+	size_t count;
+};
+
+template <typename SquareBounds>
+void buildPythagorasTreeLod(const int iters, const SquareBounds& square_bounds, PythagorasTreeLod& lod)
+{
+	// Subtrees rooted in cluster_iter are the clusters. A cluster has one contiguous range per level, so its
+	// bounds and the largest square side of each of its levels are enough to cull it and cut off its detail.
+	lod.iters = iters;
+	lod.cluster_iter = glm::clamp(iters - 6, 1, 13);
+
+	const size_t clusters = static_cast<size_t>(1) << (lod.cluster_iter - 1);
+	const int levels = iters - lod.cluster_iter + 1;
+
+	lod.bounds.assign(clusters, glm::vec4(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX));
+	lod.max_sides.assign(clusters * levels, 0.f);
+	lod.last_iters.resize(clusters);
+
+	for (int level = 0; level < levels; level++)
+	{
+		const size_t first = pythagorasTreeSize(lod.cluster_iter + level - 1);
+
+		for (size_t cluster = 0; cluster < clusters; cluster++)
+		{
+			glm::vec4& bounds = lod.bounds[cluster];
+			float& max_side = lod.max_sides[cluster * levels + level];
+
+			const size_t cluster_first = first + (cluster << level);
+			for (size_t i = cluster_first; i < cluster_first + (static_cast<size_t>(1) << level); i++)
+			{
+				glm::vec2 min;
+				glm::vec2 max;
+				float side;
+				square_bounds(i, min, max, side);
+
+				bounds.x = glm::min(bounds.x, min.x);
+				bounds.y = glm::min(bounds.y, min.y);
+				bounds.z = glm::max(bounds.z, max.x);
+				bounds.w = glm::max(bounds.w, max.y);
+				max_side = glm::max(max_side, side);
+			}
+		}
+	}
+}
+
+void buildPythagorasTreeLod(const PythagorasSquare* squares, const int iters, PythagorasTreeLod& lod)
+{
+	buildPythagorasTreeLod(iters, [&](const size_t i, glm::vec2& min, glm::vec2& max, float& side)
+	{
+		const PythagorasSquare& square = squares[i];
+		const float radius = square.side * 1.41421356f;
+		min = glm::vec2(square.x - radius, square.y - radius);
+		max = glm::vec2(square.x + radius, square.y + radius);
+		side = square.side;
+	}, lod);
+}
+
+void buildPythagorasTreeLod(const PythagorasMesh& mesh, const int iters, PythagorasTreeLod& lod)
+{
+	buildPythagorasTreeLod(iters, [&](const size_t i, glm::vec2& min, glm::vec2& max, float& side)
+	{
+		glm::vec2 corners[4];
+		for (int corner = 0; corner < 4; corner++)
+		{
+			const GLuint point = mesh.short_corners.empty() ? mesh.corners[4 * i + corner] : mesh.short_corners[4 * i + corner];
+			corners[corner] = glm::vec2(mesh.points[2 * point], mesh.points[2 * point + 1]);
+		}
+
+		min = glm::min(glm::min(corners[0], corners[1]), glm::min(corners[2], corners[3]));
+		max = glm::max(glm::max(corners[0], corners[1]), glm::max(corners[2], corners[3]));
+		side = glm::length(corners[1] - corners[0]);
+	}, lod);
+}
+
+void buildPythagorasTreeLod(const GLfloat side, const float angle, const int iters, const bool reversing, PythagorasTreeLod& lod)
+{
+	// Squares generated on the GPU are never on the CPU, so clusters are bounded from their roots alone. A child is
+	// at most scale times its parent.
+	lod.iters = iters;
+	lod.cluster_iter = glm::clamp(iters - 6, 1, 13);
+
+	const size_t clusters = static_cast<size_t>(1) << (lod.cluster_iter - 1);
+	const int levels = iters - lod.cluster_iter + 1;
+	const float scale = glm::max(glm::sin(glm::radians(angle)), glm::cos(glm::radians(angle)));
+
+	std::vector<PythagorasSquare> roots;
+	genPythagorasSquares(side, angle, lod.cluster_iter, reversing, 1, roots, NULL);
+
+	lod.bounds.resize(clusters);
+	lod.max_sides.resize(clusters * levels);
+	lod.last_iters.resize(clusters);
+
+	for (size_t cluster = 0; cluster < clusters; cluster++)
+	{
+		const PythagorasSquare& root = roots[pythagorasTreeSize(lod.cluster_iter - 1) + cluster];
+		lod.bounds[cluster] = pythagorasSubtreeBounds(root, lod.cluster_iter == 1 || cluster % 2 == 0, angle, iters, reversing);
+
+		float max_side = root.side;
+		for (int level = 0; level < levels; level++)
+		{
+			lod.max_sides[cluster * levels + level] = max_side;
+			max_side *= scale;
+		}
+	}
+}
+
+void selectPythagorasTreeRanges(PythagorasTreeLod&            lod,
+                                const glm::mat4&              mvp,
+                                const glm::vec2&              viewport,
+                                const float                   min_pixels,
+                                const GLfloat                 depth,
+                                std::vector<PythagorasRange>& ranges)
+{
+	// A LOD is empty until a builder thread has finished its tree.
+	ranges.clear();
+	if (lod.iters < 1 || lod.cluster_iter < 1)
+		return;
+
+	const size_t clusters = lod.bounds.size();
+	const int levels = lod.iters - lod.cluster_iter + 1;
+
+	// A world length l covers at most l * |row| / w of the clip space, which is half of the viewport.
+	const float pixels_per_unit = 0.5f * glm::max(glm::length(glm::vec3(mvp[0][0], mvp[1][0], mvp[2][0])) * viewport.x,
+	                                              glm::length(glm::vec3(mvp[0][1], mvp[1][1], mvp[2][1])) * viewport.y);
+
+	for (size_t cluster = 0; cluster < clusters; cluster++)
+	{
+		const glm::vec4& bounds = lod.bounds[cluster];
+
+		int outside[6] = { 0, 0, 0, 0, 0, 0 };
+		float min_w = FLT_MAX;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			const glm::vec4 clip = mvp * glm::vec4(corner & 1 ? bounds.z : bounds.x,
+			                                       corner & 2 ? bounds.w : bounds.y,
+			                                       corner & 4 ? depth * 0.5f : -depth * 0.5f,
+			                                       1.f);
+			outside[0] += clip.x < -clip.w;
+			outside[1] += clip.x > clip.w;
+			outside[2] += clip.y < -clip.w;
+			outside[3] += clip.y > clip.w;
+			outside[4] += clip.z < -clip.w;
+			outside[5] += clip.z > clip.w;
+			min_w = glm::min(min_w, clip.w);
+		}
+
+		int& last_iter = lod.last_iters[cluster];
+		last_iter = lod.cluster_iter - 1;
+		if (std::find(outside, outside + 6, 8) != outside + 6)
+			continue;
+
+		last_iter = lod.iters;
+		if (min_w <= 0.f)
+			continue;
+
+		// Subtrees are about as much larger than their roots as the cluster is larger than its root, so a level is
+		// dropped when the subtrees it starts would be smaller than min_pixels.
+		const float* const max_sides = &lod.max_sides[cluster * levels];
+		const float subtree_scale = glm::max(bounds.z - bounds.x, bounds.w - bounds.y) / max_sides[0];
+		const float pixels = subtree_scale * pixels_per_unit / min_w;
+
+		last_iter = lod.cluster_iter;
+		while (last_iter < lod.iters && max_sides[last_iter + 1 - lod.cluster_iter] * pixels >= min_pixels)
+			last_iter++;
+	}
+
+	// Runs of clusters drawn down to a level are contiguous in that level, and a fully drawn level is contiguous
+	// with the next one, so the whole tree becomes a single range when nothing is culled.
+	if (lod.cluster_iter > 1)
+	{
+		PythagorasRange range = { 0, pythagorasTreeSize(lod.cluster_iter - 1) };
+		ranges.push_back(range);
+	}
+
+	for (int iter = lod.cluster_iter; iter <= lod.iters; iter++)
+	{
+		const int shift = iter - lod.cluster_iter;
+		const size_t first = pythagorasTreeSize(iter - 1);
+
+		for (size_t cluster = 0; cluster < clusters; cluster++)
+		{
+			if (lod.last_iters[cluster] < iter)
+				continue;
+
+			PythagorasRange range = { first + (cluster << shift), static_cast<size_t>(1) << shift };
+			if (!ranges.empty() && ranges.back().first + ranges.back().count == range.first)
+				ranges.back().count += range.count;
+			else
+				ranges.push_back(range);
+		}
+	}
+}
+
+void appendLittleEndian(std::vector<unsigned char>& data, const uint64_t value, const int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		data.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+void appendLittleEndian(std::vector<unsigned char>& data, const float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	appendLittleEndian(data, bits, 4);
+}
+
+void appendLittleEndian(std::vector<unsigned char>& data, const glm::vec3& value)
+{
+	appendLittleEndian(data, value.x);
+	appendLittleEndian(data, value.y);
+	appendLittleEndian(data, value.z);
+}
+
+void writeData(std::ofstream& file, std::vector<unsigned char>& data)
+{
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	data.clear();
+}
+
+void pythagorasMeshTriangle(const PythagorasMeshSquare& square, const int triangle, GLuint vertices[3])
+{
+	// Point p has its front vertex at 2p and its back vertex at 2p + 1. The winding of cube_elements is
+	// reversed to make the faces counter-clockwise from outside, as the file formats expect.
+	const int order[3] = { 0, 2, 1 };
+	for (int i = 0; i < 3; i++)
+	{
+		const GLuint element = cube_elements[triangle * 3 + order[i]];
+		vertices[i] = 2 * square.points[element % 4] + element / 4;
+	}
+}
+
+bool exportPythagorasStl(const std::string& file_name, const GLfloat side, const GLfloat depth, const float angle, const int iters, const bool reversing)
+{
+	std::ofstream file(file_name, std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	// STL has no indices; the iteration goes to the attribute byte count of every triangle.
+	std::string header = "Pythagoras tree";
+	header.resize(80, ' ');
+	file.write(header.data(), header.size());
+
+	std::vector<unsigned char> data;
+	appendLittleEndian(data, static_cast<unsigned long>(12 * pythagorasTreeSize(iters)), 4);
+	writeData(file, data);
+
+	walkPythagorasMesh(side, angle, iters, reversing, PythagorasPointCallback(), [&](const PythagorasMeshSquare& square, const int iter)
+	{
+		glm::vec3 vertices[8];
+		for (int i = 0; i < 4; i++)
+		{
+			vertices[i] = glm::vec3(square.corners[i], depth * 0.5f);
+			vertices[4 + i] = glm::vec3(square.corners[i], -depth * 0.5f);
+		}
+
+		for (int triangle = 0; triangle < 12; triangle++)
+		{
+			const int order[3] = { 0, 2, 1 };
+			glm::vec3 triangle_vertices[3];
+			for (int i = 0; i < 3; i++)
+				triangle_vertices[i] = vertices[cube_elements[triangle * 3 + order[i]]];
+
+			glm::vec3 normal = glm::cross(triangle_vertices[1] - triangle_vertices[0], triangle_vertices[2] - triangle_vertices[0]);
+			if (glm::length(normal) > 0.f)
+				normal = glm::normalize(normal);
+
+			appendLittleEndian(data, normal);
+			for (int i = 0; i < 3; i++)
+				appendLittleEndian(data, triangle_vertices[i]);
+			appendLittleEndian(data, iter, 2);
+		}
+		writeData(file, data);
+	});
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool exportPythagorasPly(const std::string& file_name, const GLfloat side, const GLfloat depth, const float angle, const int iters, const bool reversing)
+{
+	std::ofstream file(file_name, std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	// The vertex count is known only after the vertices are streamed, so it is written over a fixed width placeholder.
+	file << "ply\nformat binary_little_endian 1.0\ncomment Pythagoras tree\nelement vertex ";
+	const std::streampos vertices_number_position = file.tellp();
+	file << "0000000000\nproperty float x\nproperty float y\nproperty float z\n"
+	     << "element face " << 12 * pythagorasTreeSize(iters) << "\n"
+	     << "property list uchar uint vertex_indices\nproperty int iter\nend_header\n";
+
+	std::vector<unsigned char> data;
+
+	const GLuint points = walkPythagorasMesh(side, angle, iters, reversing, [&](const glm::vec2& point, const int)
+	{
+		appendLittleEndian(data, glm::vec3(point, depth * 0.5f));
+		appendLittleEndian(data, glm::vec3(point, -depth * 0.5f));
+		if (data.size() >= 65536)
+			writeData(file, data);
+	}, PythagorasSquareCallback());
+	writeData(file, data);
+
+	walkPythagorasMesh(side, angle, iters, reversing, PythagorasPointCallback(), [&](const PythagorasMeshSquare& square, const int iter)
+	{
+		for (int triangle = 0; triangle < 12; triangle++)
+		{
+			GLuint vertices[3];
+			pythagorasMeshTriangle(square, triangle, vertices);
+
+			data.push_back(3);
+			for (int i = 0; i < 3; i++)
+				appendLittleEndian(data, vertices[i], 4);
+			appendLittleEndian(data, iter, 4);
+		}
+		if (data.size() >= 65536)
+			writeData(file, data);
+	});
+	writeData(file, data);
+
+	std::stringstream sstream;
+	sstream.width(10);
+	sstream.fill('0');
+	sstream << 2ul * points;
+
+	file.seekp(vertices_number_position);
+	file << sstream.str();
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool exportPythagorasGltf(const std::string& file_name, const GLfloat side, const GLfloat depth, const float angle, const int iters, const bool reversing)
+{
+	const size_t dot = file_name.find_last_of('.');
+	const std::string buffer_file_name = file_name.substr(0, dot) + ".bin";
+	const size_t slash = buffer_file_name.find_last_of("/\\");
+	const std::string buffer_uri = slash == std::string::npos ? buffer_file_name : buffer_file_name.substr(slash + 1);
+
+	std::ofstream buffer_file(buffer_file_name, std::ios::binary);
+	if (!buffer_file.good())
+	{
+		std::cerr << "Cannot open " + buffer_file_name + " export file" << std::endl;
+		return false;
+	}
+
+	// Positions are interleaved with the _ITER attribute, the iteration of the first square using the vertex.
+	std::vector<unsigned char> data;
+	glm::vec3 min_position(depth * 0.5f);
+	glm::vec3 max_position(-depth * 0.5f);
+
+	const GLuint points = walkPythagorasMesh(side, angle, iters, reversing, [&](const glm::vec2& point, const int iter)
+	{
+		const float z[2] = { depth * 0.5f, -depth * 0.5f };
+		for (int i = 0; i < 2; i++)
+		{
+			const glm::vec3 position(point, z[i]);
+			min_position = glm::min(min_position, position);
+			max_position = glm::max(max_position, position);
+
+			appendLittleEndian(data, position);
+			appendLittleEndian(data, static_cast<float>(iter));
+		}
+		if (data.size() >= 65536)
+			writeData(buffer_file, data);
+	}, PythagorasSquareCallback());
+	writeData(buffer_file, data);
+
+	walkPythagorasMesh(side, angle, iters, reversing, PythagorasPointCallback(), [&](const PythagorasMeshSquare& square, const int)
+	{
+		for (int triangle = 0; triangle < 12; triangle++)
+		{
+			GLuint vertices[3];
+			pythagorasMeshTriangle(square, triangle, vertices);
+			for (int i = 0; i < 3; i++)
+				appendLittleEndian(data, vertices[i], 4);
+		}
+		if (data.size() >= 65536)
+			writeData(buffer_file, data);
+	});
+	writeData(buffer_file, data);
+
+	buffer_file.close();
+	if (!buffer_file)
+	{
+		std::cerr << "Cannot write " + buffer_file_name + " export file" << std::endl;
+		return false;
+	}
+
+	const size_t vertices_number = 2 * static_cast<size_t>(points);
+	const size_t indices_number = 36 * pythagorasTreeSize(iters);
+
+	std::ofstream file(file_name);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	file.precision(9);
+	file << "{\n"
+	     << "  \"asset\": { \"version\": \"2.0\", \"generator\": \"PythagorasTree\" },\n"
+	     << "  \"scene\": 0,\n"
+	     << "  \"scenes\": [ { \"nodes\": [ 0 ] } ],\n"
+	     << "  \"nodes\": [ { \"mesh\": 0 } ],\n"
+	     << "  \"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0, \"_ITER\": 1 }, \"indices\": 2 } ] } ],\n"
+	     << "  \"buffers\": [ { \"uri\": \"" << buffer_uri << "\", \"byteLength\": " << vertices_number * 16 + indices_number * 4 << " } ],\n"
+	     << "  \"bufferViews\": [\n"
+	     << "    { \"buffer\": 0, \"byteOffset\": 0, \"byteLength\": " << vertices_number * 16 << ", \"byteStride\": 16, \"target\": 34962 },\n"
+	     << "    { \"buffer\": 0, \"byteOffset\": " << vertices_number * 16 << ", \"byteLength\": " << indices_number * 4 << ", \"target\": 34963 }\n"
+	     << "  ],\n"
+	     << "  \"accessors\": [\n"
+	     << "    { \"bufferView\": 0, \"byteOffset\": 0, \"componentType\": 5126, \"count\": " << vertices_number << ", \"type\": \"VEC3\", "
+	     << "\"min\": [ " << min_position.x << ", " << min_position.y << ", " << min_position.z << " ], "
+	     << "\"max\": [ " << max_position.x << ", " << max_position.y << ", " << max_position.z << " ] },\n"
+	     << "    { \"bufferView\": 0, \"byteOffset\": 12, \"componentType\": 5126, \"count\": " << vertices_number << ", \"type\": \"SCALAR\" },\n"
+	     << "    { \"bufferView\": 1, \"byteOffset\": 0, \"componentType\": 5125, \"count\": " << indices_number << ", \"type\": \"SCALAR\" }\n"
+	     << "  ]\n"
+	     << "}\n";
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool exportPythagorasTree(const std::string& file_name,
+                          const GLfloat      side,
+                          const GLfloat      depth,
+                          const float        angle,
+                          const int          iters,
+                          const bool         reversing)
+{
+	if (!checkPythagorasTreeArguments(side, angle, iters))
+		return false;
+
+	// Every format indexes the vertices or counts the triangles with 32-bit integers.
+	if (pythagorasTreeSize(iters) > 0xfffffffful / 12)
+	{
+		std::cerr << "Too many iterations to export" << std::endl;
+		return false;
+	}
+
+	const size_t dot = file_name.find_last_of('.');
+	const std::string extension = dot == std::string::npos ? "" : file_name.substr(dot + 1);
+	if (extension == "stl" || extension == "STL")
+		return exportPythagorasStl(file_name, side, depth, angle, iters, reversing);
+	if (extension == "ply" || extension == "PLY")
+		return exportPythagorasPly(file_name, side, depth, angle, iters, reversing);
+	if (extension == "gltf" || extension == "GLTF")
+		return exportPythagorasGltf(file_name, side, depth, angle, iters, reversing);
+
+	std::cerr << "Unknown export format of " + file_name + " (use .stl, .ply, .gltf, .svg or .pdf)" << std::endl;
+	return false;
+}
+
+typedef std::function<void(const glm::dvec2 corners[4])> PythagorasCornersCallback;
+
+void _walkPythagorasLevel(const glm::dvec2&                origin,
+                          const glm::dvec2&                direction,
+                          const double                     side,
+                          const int                        iter,
+                          const int                        level,
+                          const double                     min_side,
+                          const glm::dvec2                 turns[2],
+                          const PythagorasCornersCallback& on_square)
+{
+	// Children are smaller than their parent, so a square below min_side ends its whole subtree.
+	if (side < min_side)
+		return;
+
+	const glm::dvec2 normal(-direction.y, direction.x);
+	if (iter == level)
+	{
+		const glm::dvec2 corners[4] = { origin, origin + direction * side, origin + (direction + normal) * side, origin + normal * side };
+		on_square(corners);
+		return;
+	}
+
+	const glm::dvec2 turn = turns[(iter + 1) % 2];
+	const glm::dvec2 left_direction(direction.x * turn.x - direction.y * turn.y, direction.x * turn.y + direction.y * turn.x);
+	const glm::dvec2 left_origin = origin + normal * side;
+
+	_walkPythagorasLevel(left_origin, left_direction, side * turn.x, iter + 1, level, min_side, turns, on_square);
+	_walkPythagorasLevel(left_origin + left_direction * (side * turn.x), glm::dvec2(left_direction.y, -left_direction.x), side * turn.y, iter + 1, level,
+	                     min_side, turns, on_square);
+}
+
+void walkPythagorasLevel(const GLfloat                    side,
+                         const float                      angle,
+                         const int                        level,
+                         const bool                       reversing,
+                         const double                     min_side,
+                         const PythagorasCornersCallback& on_square)
+{
+	// Depth first through the squares above min_side, so only the path to the current square is kept.
+	glm::dvec2 turns[2];
+	for (int i = 0; i < 2; i++)
+	{
+		const double turn_angle = glm::radians(static_cast<double>(pythagorasLevelAngle(angle, 2 + i, reversing)));
+		turns[i] = glm::dvec2(std::cos(turn_angle), std::sin(turn_angle));
+	}
+
+	_walkPythagorasLevel(glm::dvec2(0.0, 0.0), glm::dvec2(1.0, 0.0), side, 1, level, min_side, turns, on_square);
+}
+
+glm::vec3 pythagorasLevelColor(const glm::vec3& first_color, const glm::vec3& last_color, const int iter, const int iters)
+{
+	// The unlit color of pt_fragment_shader.frag.
+	const float ratio = iters > 1 ? 1.f - static_cast<float>(iter - 1) / (iters - 1) : 1.f;
+	return last_color + (first_color - last_color) * ratio;
+}
+
+struct PythagorasDrawingLayout
+{
+	glm::vec4 bounds;
+	double    scale;
+	double    width;
+	double    height;
+	int       levels;
+};
+
+void layoutPythagorasDrawing(const GLfloat            side,
+                             const float              angle,
+                             const int                iters,
+                             const bool               reversing,
+                             const double             width,
+                             const double             min_side,
+                             PythagorasDrawingLayout& layout)
+{
+	// The tree fills the width of the drawing, and levels without a square of min_side are not walked at all.
+	const PythagorasSquare root = { 0.f, 0.f, 0.f, side, 1 };
+	layout.bounds = pythagorasSubtreeBounds(root, true, angle, iters, reversing);
+	layout.scale = width / (layout.bounds.z - layout.bounds.x);
+	layout.width = width;
+	layout.height = (layout.bounds.w - layout.bounds.y) * layout.scale;
+	layout.levels = pythagorasVisibleIters(side, angle, iters, reversing, static_cast<float>(min_side / layout.scale));
+}
+
+bool exportPythagorasSvg(const std::string& file_name,
+                         const GLfloat      side,
+                         const float        angle,
+                         const int          iters,
+                         const bool         reversing,
+                         const glm::vec3&   first_color,
+                         const glm::vec3&   last_color,
+                         const double       width,
+                         const double       min_side)
+{
+	std::ofstream file(file_name, std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	PythagorasDrawingLayout layout;
+	layoutPythagorasDrawing(side, angle, iters, reversing, width, min_side, layout);
+
+	file.precision(2);
+	file << std::fixed << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	     << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << layout.width << "\" height=\"" << layout.height
+	     << "\" viewBox=\"0 0 " << layout.width << " " << layout.height << "\">\n";
+
+	// One path per level, as all its squares have the same color. The deepest level comes first, so the lower levels
+	// cover it where they overlap, as on screen.
+	for (int level = layout.levels; level >= 1; level--)
+	{
+		bool is_path_open = false;
+		walkPythagorasLevel(side, angle, level, reversing, min_side / layout.scale, [&](const glm::dvec2 corners[4])
+		{
+			if (!is_path_open)
+			{
+				const glm::vec3 color = pythagorasLevelColor(first_color, last_color, level, iters);
+				const char hex_digits[] = "0123456789abcdef";
+				file << "<path fill=\"#";
+				for (int i = 0; i < 3; i++)
+				{
+					const int component = static_cast<int>(std::round(glm::clamp(color[i], 0.f, 1.f) * 255.f));
+					file << hex_digits[component >> 4] << hex_digits[component & 15];
+				}
+				file << "\" d=\"";
+				is_path_open = true;
+			}
+
+			for (int i = 0; i < 4; i++)
+				file << (i == 0 ? "M" : "L") << (corners[i].x - layout.bounds.x) * layout.scale << " " << (layout.bounds.w - corners[i].y) * layout.scale;
+			file << "Z";
+		});
+
+		if (is_path_open)
+			file << "\"/>\n";
+	}
+
+	file << "</svg>\n";
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool exportPythagorasPdf(const std::string& file_name,
+                         const GLfloat      side,
+                         const float        angle,
+                         const int          iters,
+                         const bool         reversing,
+                         const glm::vec3&   first_color,
+                         const glm::vec3&   last_color,
+                         const double       width,
+                         const double       min_side)
+{
+	std::ofstream file(file_name, std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	PythagorasDrawingLayout layout;
+	layoutPythagorasDrawing(side, angle, iters, reversing, width, min_side, layout);
+
+	// A single page whose content stream is written as the squares are walked; its length follows it as an indirect
+	// object, so nothing has to be held back.
+	std::vector<std::streamoff> offsets;
+	file.precision(2);
+	file << std::fixed << "%PDF-1.4\n";
+
+	offsets.push_back(file.tellp());
+	file << "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n";
+	offsets.push_back(file.tellp());
+	file << "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n";
+	offsets.push_back(file.tellp());
+	file << "3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 " << layout.width << " " << layout.height << "] /Contents 4 0 R /Resources << >> >>\nendobj\n";
+	offsets.push_back(file.tellp());
+	file << "4 0 obj\n<< /Length 5 0 R >>\nstream\n";
+
+	const std::streamoff stream_start = file.tellp();
+	for (int level = layout.levels; level >= 1; level--)
+	{
+		bool is_path_open = false;
+		walkPythagorasLevel(side, angle, level, reversing, min_side / layout.scale, [&](const glm::dvec2 corners[4])
+		{
+			if (!is_path_open)
+			{
+				const glm::vec3 color = pythagorasLevelColor(first_color, last_color, level, iters);
+				file.precision(3);
+				for (int i = 0; i < 3; i++)
+					file << glm::clamp(color[i], 0.f, 1.f) << " ";
+				file << "rg\n";
+				file.precision(2);
+				is_path_open = true;
+			}
+
+			for (int i = 0; i < 4; i++)
+				file << (corners[i].x - layout.bounds.x) * layout.scale << " " << (corners[i].y - layout.bounds.y) * layout.scale << (i == 0 ? " m " : " l ");
+			file << "h\n";
+		});
+
+		if (is_path_open)
+			file << "f\n";
+	}
+	const std::streamoff stream_length = file.tellp() - stream_start;
+
+	file << "endstream\nendobj\n";
+	offsets.push_back(file.tellp());
+	file << "5 0 obj\n" << stream_length << "\nendobj\n";
+
+	const std::streamoff xref_offset = file.tellp();
+	file << "xref\n0 " << offsets.size() + 1 << "\n0000000000 65535 f \n";
+	file.fill('0');
+	for (size_t i = 0; i < offsets.size(); i++)
+	{
+		file.width(10);
+		file << offsets[i] << " 00000 n \n";
+	}
+	file << "trailer\n<< /Size " << offsets.size() + 1 << " /Root 1 0 R >>\nstartxref\n" << xref_offset << "\n%%EOF\n";
+
+	file.close();
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " export file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool exportPythagorasDrawing(const std::string& file_name,
+                             const GLfloat      side,
+                             const float        angle,
+                             const int          iters,
+                             const bool         reversing,
+                             const glm::vec3&   first_color,
+                             const glm::vec3&   last_color,
+                             const double       width,
+                             const double       min_side)
+{
+	if (!checkPythagorasTreeArguments(side, angle, iters))
+		return false;
+
+	const size_t dot = file_name.find_last_of('.');
+	const std::string extension = dot == std::string::npos ? "" : file_name.substr(dot + 1);
+	if (extension == "svg" || extension == "SVG")
+		return exportPythagorasSvg(file_name, side, angle, iters, reversing, first_color, last_color, width, min_side);
+	if (extension == "pdf" || extension == "PDF")
+		return exportPythagorasPdf(file_name, side, angle, iters, reversing, first_color, last_color, width, min_side);
+
+	std::cerr << "Unknown drawing format of " + file_name + " (use .svg or .pdf)" << std::endl;
+	return false;
+}
+
+void appendPythagorasSquare(std::vector<unsigned char>& data, const PythagorasSquare& square)
+{
+	appendLittleEndian(data, square.x);
+	appendLittleEndian(data, square.y);
+	appendLittleEndian(data, square.rotation);
+	appendLittleEndian(data, square.side);
+	appendLittleEndian(data, static_cast<uint64_t>(square.iter), 4);
+}
+
+bool streamPythagorasTree(const std::string& file_name,
+                          const GLfloat      side,
+                          const float        angle,
+                          const int          iters,
+                          const bool         reversing,
+                          const unsigned int threads,
+                          const size_t       memory_limit)
+{
+	if (!checkPythagorasTreeArguments(side, angle, iters))
+		return false;
+
+	// The tree is split into the subtrees of chunk_iter, generated one per worker at a time, so chunk_iter is the
+	// first level whose subtrees fit the memory limit together with their squares serialized and their nodes.
+	const unsigned int workers = generationThreads(threads);
+	int chunk_iter = 1;
+	while (chunk_iter < iters &&
+	       workers * (pythagorasTreeSize(iters - chunk_iter + 1) * 2 * sizeof(PythagorasSquare) +
+	                  (static_cast<size_t>(1) << (iters - chunk_iter)) * sizeof(PythagorasNode)) > memory_limit)
+	{
+		chunk_iter++;
+	}
+
+	const size_t chunks = static_cast<size_t>(1) << (chunk_iter - 1);
+	const size_t chunk_squares = pythagorasTreeSize(iters - chunk_iter + 1);
+	const size_t prefix_squares = pythagorasTreeSize(chunk_iter - 1);
+	const size_t square_size = 20;
+
+	std::ofstream file(file_name, std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Cannot create " + file_name + " stream file" << std::endl;
+		return false;
+	}
+
+	// Header, then the index of the prefix above chunk_iter and of every subtree chunk, then their squares in the
+	// same order. An entry holds the root level and index of its subtree, its level count, offset and square count.
+	const size_t header_size = 48;
+	const size_t entry_size = 32;
+	size_t offset = header_size + (chunks + 1) * entry_size;
+
+	std::vector<unsigned char> data;
+	data.insert(data.end(), "PTSTREAM", "PTSTREAM" + 8);
+	appendLittleEndian(data, static_cast<uint64_t>(1), 4);
+	appendLittleEndian(data, static_cast<uint64_t>(iters), 4);
+	appendLittleEndian(data, static_cast<uint64_t>(chunk_iter), 4);
+	appendLittleEndian(data, static_cast<uint64_t>(reversing), 4);
+	appendLittleEndian(data, side);
+	appendLittleEndian(data, angle);
+	appendLittleEndian(data, static_cast<uint64_t>(chunks + 1), 8);
+	appendLittleEndian(data, static_cast<uint64_t>(header_size), 8);
+
+	appendLittleEndian(data, static_cast<uint64_t>(1), 4);
+	appendLittleEndian(data, static_cast<uint64_t>(chunk_iter - 1), 4);
+	appendLittleEndian(data, static_cast<uint64_t>(0), 8);
+	appendLittleEndian(data, static_cast<uint64_t>(offset), 8);
+	appendLittleEndian(data, static_cast<uint64_t>(prefix_squares), 8);
+	offset += prefix_squares * square_size;
+
+	for (size_t chunk = 0; chunk < chunks; chunk++)
+	{
+		appendLittleEndian(data, static_cast<uint64_t>(chunk_iter), 4);
+		appendLittleEndian(data, static_cast<uint64_t>(iters - chunk_iter + 1), 4);
+		appendLittleEndian(data, static_cast<uint64_t>(chunk), 8);
+		appendLittleEndian(data, static_cast<uint64_t>(offset + chunk * chunk_squares * square_size), 8);
+		appendLittleEndian(data, static_cast<uint64_t>(chunk_squares), 8);
+	}
+	writeData(file, data);
+
+	// The prefix is generated whole; its last level is kept to expand into the roots of the chunks.
+	PythagorasNodes roots;
+	if (chunk_iter == 1)
+	{
+		resizePythagorasNodes(roots, 1);
+		storePythagorasNode(roots, 0, pythagorasRootNode(side));
+	}
+	else
+	{
+		std::vector<PythagorasSquare> prefix;
+		genPythagorasSquares(side, angle, chunk_iter - 1, reversing, threads, prefix, &roots);
+
+		for (size_t i = 0; i < prefix.size(); i++)
+			appendPythagorasSquare(data, prefix[i]);
+		writeData(file, data);
+
+		resizePythagorasNodes(roots, chunks);
+		_expandPythagorasLevel(roots, chunks / 2, pythagorasLevelAngle(angle, chunk_iter - 1, reversing), chunk_iter - 1, 0, reversing);
+	}
+
+	const float chunk_angle = pythagorasLevelAngle(angle, chunk_iter, reversing);
+	const std::streamoff chunks_offset = file.tellp();
+
+	std::mutex file_mutex;
+	WorkStealingPool pool(workers);
+
+	for (size_t chunk = 0; chunk < chunks; chunk++)
+	{
+		const PythagorasNode root = loadPythagorasNode(roots, chunk);
+		pool.submit([=, &file, &file_mutex]
+		{
+			std::vector<PythagorasSquare> squares(chunk_squares);
+			PythagorasTreeBuffers buffers = { squares.data(), NULL, chunk_iter, chunk };
+
+			PythagorasNodes nodes;
+			_genPythagorasSubtree(root, chunk_iter, chunk, iters, chunk_angle, reversing, nodes, buffers);
+
+			std::vector<unsigned char> chunk_data;
+			chunk_data.reserve(chunk_squares * square_size);
+			for (size_t i = 0; i < chunk_squares; i++)
+				appendPythagorasSquare(chunk_data, squares[i]);
+
+			std::lock_guard<std::mutex> lock(file_mutex);
+			file.seekp(chunks_offset + static_cast<std::streamoff>(chunk * chunk_squares * square_size));
+			writeData(file, chunk_data);
+		});
+	}
+
+	pool.wait();
+
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " stream file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+struct Options
+{
+	bool                     is_headless;
+	bool                     is_benchmark;
+	bool                     is_verifying_gpu;
+	bool                     is_analyzing;
+	bool                     is_poster;
+	bool                     is_picking;
+	glm::vec2                pick_point;
+	bool                     is_querying;
+	glm::vec2                query_min;
+	glm::vec2                query_max;
+	int                      width;
+	int                      height;
+	int                      frames;
+	int                      supersampling;
+	int                      tile_size;
+	std::string              output;
+	float                    camera_yaw;
+	float                    camera_pitch;
+	float                    camera_distance;
+	float                    camera_yaw_step;
+	float                    ortho_width;
+	glm::vec2                ortho_position;
+	int                      benchmark_first_iters;
+	int                      benchmark_last_iters;
+	std::vector<float>       benchmark_angles;
+	std::vector<bool>        benchmark_reversing;
+	int                      benchmark_frames;
+	std::string              benchmark_format;
+	std::string              benchmark_output;
+	std::string              export_file;
+	double                   export_width;
+	double                   export_min_side;
+	std::string              stream_file;
+	size_t                   stream_memory;
+	std::string              profile;
+	std::vector<std::string> settings_overrides;
+	std::string              batch_file;
+	bool                     is_reporting_stats;
+	std::string              trace_file;
+};
+
+bool parseOptions(const int argc, char* argv[], Options& options)
+{
+	options.is_headless = false;
+	options.is_benchmark = false;
+	options.is_verifying_gpu = false;
+	options.is_analyzing = false;
+	options.is_poster = false;
+	options.is_picking = false;
+	options.is_querying = false;
+	options.width = 600;
+	options.height = 600;
+	options.frames = 1;
+	options.supersampling = 1;
+	options.tile_size = 512;
+	options.output = "frame.png";
+	options.camera_yaw = 0.f;
+	options.camera_pitch = 0.f;
+	options.camera_distance = 7.f;
+	options.camera_yaw_step = 0.f;
+	options.ortho_width = 4.f;
+	options.ortho_position = glm::vec2(0.f, 0.f);
+	options.benchmark_first_iters = 1;
+	options.benchmark_last_iters = 20;
+	options.benchmark_angles.assign(1, 45.f);
+	options.benchmark_reversing.push_back(false);
+	options.benchmark_reversing.push_back(true);
+	options.benchmark_frames = 1;
+	options.benchmark_format = "csv";
+	options.export_width = 1000.0;
+	options.export_min_side = 0.5;
+	options.stream_memory = 256;
+	options.is_reporting_stats = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string option = argv[i];
+
+		if (option == "--headless")
+		{
+			options.is_headless = true;
+			continue;
+		}
+
+		if (option == "--benchmark")
+		{
+			options.is_benchmark = true;
+			continue;
+		}
+
+		if (option == "--verify-gpu")
+		{
+			options.is_verifying_gpu = true;
+			continue;
+		}
+
+		if (option == "--analyze")
+		{
+			options.is_analyzing = true;
+			continue;
+		}
+
+		if (option == "--poster")
+		{
+			options.is_poster = true;
+			continue;
+		}
+
+		if (option == "--stats")
+		{
+			options.is_reporting_stats = true;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			std::cerr << "Missing value of " + option + " option" << std::endl;
+			return false;
+		}
+
+		std::stringstream sstream;
+		sstream << argv[++i];
+
+		if (option == "--width")
+			sstream >> options.width;
+		else if (option == "--height")
+			sstream >> options.height;
+		else if (option == "--frames")
+			sstream >> options.frames;
+		else if (option == "--supersampling")
+			sstream >> options.supersampling;
+		else if (option == "--tile-size")
+			sstream >> options.tile_size;
+		else if (option == "--output")
+			sstream >> options.output;
+		else if (option == "--camera-yaw")
+			sstream >> options.camera_yaw;
+		else if (option == "--camera-pitch")
+			sstream >> options.camera_pitch;
+		else if (option == "--camera-distance")
+			sstream >> options.camera_distance;
+		else if (option == "--camera-yaw-step")
+			sstream >> options.camera_yaw_step;
+		else if (option == "--ortho-width")
+			sstream >> options.ortho_width;
+		else if (option == "--ortho-position")
+		{
+			char comma;
+			sstream >> options.ortho_position.x >> comma >> options.ortho_position.y;
+		}
+		else if (option == "--pick")
+		{
+			char comma;
+			sstream >> options.pick_point.x >> comma >> options.pick_point.y;
+			options.is_picking = true;
+		}
+		else if (option == "--query")
+		{
+			char commas[3];
+			sstream >> options.query_min.x >> commas[0] >> options.query_min.y >> commas[1] >> options.query_max.x >> commas[2] >> options.query_max.y;
+			options.is_querying = true;
+		}
+		else if (option == "--benchmark-iterations")
+		{
+			sstream >> options.benchmark_first_iters;
+			options.benchmark_last_iters = options.benchmark_first_iters;
+
+			char dash;
+			if (sstream >> dash)
+				sstream >> options.benchmark_last_iters;
+			else
+				sstream.clear();
+		}
+		else if (option == "--benchmark-angles" || option == "--benchmark-reversing")
+		{
+			const bool is_angles = option == "--benchmark-angles";
+			if (is_angles)
+				options.benchmark_angles.clear();
+			else
+				options.benchmark_reversing.clear();
+
+			bool is_valid = true;
+			std::string value;
+			while (is_valid && std::getline(sstream, value, ','))
+			{
+				std::stringstream value_sstream;
+				value_sstream << value;
+
+				if (is_angles)
+				{
+					float angle;
+					value_sstream >> angle;
+					options.benchmark_angles.push_back(angle);
+				}
+				else
+				{
+					bool reversing;
+					value_sstream >> std::boolalpha >> reversing;
+					options.benchmark_reversing.push_back(reversing);
+				}
+
+				is_valid = !value_sstream.fail();
+			}
+
+			sstream.clear();
+			if (!is_valid)
+				sstream.setstate(std::ios::failbit);
+		}
+		else if (option == "--benchmark-frames")
+			sstream >> options.benchmark_frames;
+		else if (option == "--benchmark-format")
+			sstream >> options.benchmark_format;
+		else if (option == "--benchmark-output")
+			sstream >> options.benchmark_output;
+		else if (option == "--export")
+			sstream >> options.export_file;
+		else if (option == "--export-width")
+			sstream >> options.export_width;
+		else if (option == "--export-min-side")
+			sstream >> options.export_min_side;
+		else if (option == "--stream")
+			sstream >> options.stream_file;
+		else if (option == "--stream-memory")
+			sstream >> options.stream_memory;
+		else if (option == "--profile")
+			sstream >> options.profile;
+		else if (option == "--set")
+			options.settings_overrides.push_back(argv[i]);
+		else if (option == "--batch")
+			sstream >> options.batch_file;
+		else if (option == "--trace")
+			sstream >> options.trace_file;
+		else
+		{
+			std::cerr << "Unknown option " + option << std::endl;
+			return false;
+		}
+
+		if (!sstream)
+		{
+			std::cerr << "Bad value of " + option + " option" << std::endl;
+			return false;
+		}
+	}
+
+	if (options.width <= 0 || options.height <= 0 || options.frames <= 0 || options.supersampling <= 0 || options.tile_size <= 0 ||
+	    options.camera_distance <= 0.f || options.ortho_width <= 0.f || options.export_width <= 0.0 || options.export_min_side < 0.0 ||
+	    options.benchmark_first_iters <= 0 || options.benchmark_last_iters < options.benchmark_first_iters ||
+	    options.benchmark_angles.empty() || options.benchmark_reversing.empty() || options.benchmark_frames < 0 ||
+	    (options.benchmark_format != "csv" && options.benchmark_format != "json"))
+	{
+		std::cerr << "Wrong command line option value(s)" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+std::string frameFileName(const std::string& output, const int frame, const int frames)
+{
+	if (frames == 1)
+		return output;
+
+	std::stringstream sstream;
+	sstream.fill('0');
+	sstream.width(4);
+	sstream << frame;
+
+	const size_t dot = output.find_last_of('.');
+	if (dot == std::string::npos)
+		return output + "_" + sstream.str();
+
+	return output.substr(0, dot) + "_" + sstream.str() + output.substr(dot);
+}
+
+void resolveSupersampling(const unsigned char* color,
+                          const int            width,
+                          const int            height,
+                          const int            supersampling,
+                          const bool           is_bottom_up,
+                          unsigned char*       image)
+{
+	// Averages every supersampling x supersampling block of RGB samples into one top-down pixel.
+	const size_t raster_width = static_cast<size_t>(width) * supersampling;
+	const int samples = supersampling * supersampling;
+
+	for (int y = 0; y < height; y++)
+	{
+		const size_t raster_y = static_cast<size_t>(is_bottom_up ? height - 1 - y : y) * supersampling;
+
+		for (int x = 0; x < width; x++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				int sum = 0;
+				for (int sy = 0; sy < supersampling; sy++)
+				{
+					for (int sx = 0; sx < supersampling; sx++)
+						sum += color[((raster_y + sy) * raster_width + x * supersampling + sx) * 3 + i];
+				}
+				image[(static_cast<size_t>(y) * width + x) * 3 + i] = static_cast<unsigned char>((sum + samples / 2) / samples);
+			}
+		}
+	}
+}
+
+bool renderHeadless(const Options& options)
+{
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return false;
+
+	std::vector<PythagorasSquare> squares;
+	if (!genPythagorasSquares(settings.side, settings.angle, settings.iters, settings.reversing, settings.threads, squares, NULL))
+		return false;
+
+	PythagorasTreeLod lod;
+	buildPythagorasTreeLod(squares.data(), settings.iters, lod);
+	std::vector<PythagorasRange> ranges;
+
+	const int raster_width = options.width * options.supersampling;
+	const int raster_height = options.height * options.supersampling;
+	SoftwareRasterizer rasterizer(raster_width, raster_height);
+
+	const float window_ratio = static_cast<float>(options.width) / options.height;
+
+	SceneShading shading;
+	shading.depth = settings.depth;
+	shading.last_iter = settings.iters;
+	shading.first_color = settings.first_color;
+	shading.last_color = settings.last_color;
+	shading.is_directed_light = settings.is_directed_light;
+	shading.light_direction = glm::vec3(0.f, 0.f, -1.f);
+
+	std::vector<unsigned char> image(static_cast<size_t>(options.width) * options.height * 3);
+
+	for (int frame = 0; frame < options.frames; frame++)
+	{
+		const float yaw = options.camera_yaw + options.camera_yaw_step * frame;
+		glm::vec3 camera_position(0.f, 0.f, options.camera_distance);
+		camera_position = glm::rotate(camera_position, glm::radians(options.camera_pitch), glm::vec3(-1.f, 0.f, 0.f));
+		camera_position = glm::rotate(camera_position, glm::radians(yaw), glm::vec3(0.f, 1.f, 0.f));
+
+		if (settings.is_dynamic_light)
+			shading.light_direction = glm::rotate(shading.light_direction, glm::radians(0.3f), glm::vec3(0.f, 1.f, 0.f));
+
+		const glm::mat4 mvp = treeMvpMatrix(settings.is_3d, camera_position, options.ortho_position, options.ortho_width, options.ortho_width / window_ratio, window_ratio, settings.side);
+
+		selectPythagorasTreeRanges(lod, mvp, glm::vec2(raster_width, raster_height), settings.lod_pixels, settings.depth, ranges);
+
+		rasterizer.clear();
+		for (size_t i = 0; i < ranges.size(); i++)
+			rasterizer.drawSquares(&squares[ranges[i].first], ranges[i].count, mvp, shading);
+
+		resolveSupersampling(rasterizer.getColor().data(), options.width, options.height, options.supersampling, false, image.data());
+
+		const std::string file_name = frameFileName(options.output, frame, options.frames);
+
+		ImageWriter writer;
+		if (!writer.open(file_name, options.width, options.height) ||
+		    !writer.writeRows(image.data(), options.height) ||
+		    !writer.close())
+		{
+			return false;
+		}
+
+		std::cout << "Rendered " + file_name << std::endl;
+	}
+
+	return true;
+}
+
+size_t peakMemoryUsage()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+#if defined(__APPLE__)
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+double elapsedMilliseconds(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct PosterLayout
+{
+	int        width;
+	int        height;
+	int        tile_size;
+	int        supersampling;
+	glm::dvec2 top_left;
+	double     pixel_size;
+	float      lod_pixels;
+};
+
+void _binPythagorasSquare(const PythagorasSpatialIndex&               index,
+                          const PythagorasIndexNode&                  node,
+                          const PosterLayout&                         layout,
+                          const int                                   first_row,
+                          const int                                   last_row,
+                          std::vector<std::vector<PythagorasSquare>>& bins)
+{
+	// Only subtrees that can reach the band are walked, and branches below the LOD pixel size are cut off with
+	// everything above them.
+	const double reach = index.reaches[node.iter] * node.side;
+	const double band_top = layout.top_left.y - first_row * layout.pixel_size;
+	const double band_bottom = layout.top_left.y - last_row * layout.pixel_size;
+	if (node.origin.y - reach > band_top || node.origin.y + reach < band_bottom ||
+	    node.origin.x + reach < layout.top_left.x || node.origin.x - reach > layout.top_left.x + layout.width * layout.pixel_size ||
+	    node.side < layout.lod_pixels * layout.pixel_size)
+	{
+		return;
+	}
+
+	const glm::dvec2 normal(-node.direction.y, node.direction.x);
+	const glm::dvec2 corners[4] = { node.origin, node.origin + node.direction * node.side, node.origin + (node.direction + normal) * node.side,
+	                                node.origin + normal * node.side };
+
+	glm::dvec2 min_corner = corners[0];
+	glm::dvec2 max_corner = corners[0];
+	for (int i = 1; i < 4; i++)
+	{
+		min_corner = glm::min(min_corner, corners[i]);
+		max_corner = glm::max(max_corner, corners[i]);
+	}
+
+	const int first_column = static_cast<int>(std::floor((min_corner.x - layout.top_left.x) / layout.pixel_size)) / layout.tile_size;
+	const int last_column = static_cast<int>(std::floor((max_corner.x - layout.top_left.x) / layout.pixel_size)) / layout.tile_size;
+	if (max_corner.y > band_bottom && min_corner.y < band_top && max_corner.x > layout.top_left.x && first_column < static_cast<int>(bins.size()))
+	{
+		// Squares are kept relative to the center of their tile, so their float coordinates stay exact on any poster size.
+		const float rotation = static_cast<float>(glm::degrees(std::atan2(node.direction.y, node.direction.x)));
+		for (int column = std::max(first_column, 0); column <= std::min(last_column, static_cast<int>(bins.size()) - 1); column++)
+		{
+			const int first_x = column * layout.tile_size;
+			const int last_x = std::min(first_x + layout.tile_size, layout.width);
+			const glm::dvec2 center = layout.top_left + glm::dvec2((first_x + last_x) / 2.0, -(first_row + last_row) / 2.0) * layout.pixel_size;
+
+			const PythagorasSquare square = { static_cast<float>(node.origin.x - center.x), static_cast<float>(node.origin.y - center.y), rotation,
+			                                  static_cast<float>(node.side), node.iter };
+			bins[column].push_back(square);
+		}
+	}
+
+	if (node.iter == index.iters)
+		return;
+
+	PythagorasIndexNode children[2];
+	childPythagorasIndexNodes(index, node, children);
+	for (int i = 0; i < 2; i++)
+		_binPythagorasSquare(index, children[i], layout, first_row, last_row, bins);
+}
+
+void binPythagorasTree(const PythagorasSpatialIndex&               index,
+                       const PosterLayout&                         layout,
+                       const int                                   first_row,
+                       const int                                   last_row,
+                       std::vector<std::vector<PythagorasSquare>>& bins)
+{
+	for (size_t i = 0; i < bins.size(); i++)
+		bins[i].clear();
+
+	_binPythagorasSquare(index, index.root, layout, first_row, last_row, bins);
+}
+
+void renderPosterTile(const std::vector<PythagorasSquare>& squares,
+                      const PosterLayout&                  layout,
+                      const SceneShading&                  shading,
+                      const int                            first_x,
+                      const int                            first_row,
+                      const int                            last_row,
+                      unsigned char*                       band)
+{
+	const int tile_width = std::min(layout.tile_size, layout.width - first_x);
+	const int tile_height = last_row - first_row;
+	const float ortho_x = static_cast<float>(tile_width * layout.pixel_size);
+	const float ortho_y = static_cast<float>(tile_height * layout.pixel_size);
+	const glm::mat4 mvp = glm::ortho(-ortho_x / 2, ortho_x / 2, -ortho_y / 2, ortho_y / 2, 1.f, 50.f) * glm::translate(glm::vec3(0.f, 0.f, -7.f));
+
+	// Squares come in depth first order; drawn level by level, the lower levels win the depth test as on screen.
+	std::vector<PythagorasSquare> sorted(squares);
+	std::stable_sort(sorted.begin(), sorted.end(), [](const PythagorasSquare& a, const PythagorasSquare& b) { return a.iter < b.iter; });
+
+	SoftwareRasterizer rasterizer(tile_width * layout.supersampling, tile_height * layout.supersampling);
+	rasterizer.drawSquares(sorted.data(), sorted.size(), mvp, shading);
+
+	std::vector<unsigned char> tile(static_cast<size_t>(tile_width) * tile_height * 3);
+	resolveSupersampling(rasterizer.getColor().data(), tile_width, tile_height, layout.supersampling, false, tile.data());
+
+	for (int y = 0; y < tile_height; y++)
+		std::copy(&tile[static_cast<size_t>(y) * tile_width * 3], &tile[static_cast<size_t>(y + 1) * tile_width * 3],
+		          band + (static_cast<size_t>(y) * layout.width + first_x) * 3);
+}
+
+void submitPosterBand(WorkStealingPool&                                 pool,
+                      const std::vector<std::vector<PythagorasSquare>>& bins,
+                      const PosterLayout&                               layout,
+                      const SceneShading&                               shading,
+                      const int                                         band,
+                      unsigned char*                                    image)
+{
+	const int first_row = band * layout.tile_size;
+	const int last_row = std::min(first_row + layout.tile_size, layout.height);
+
+	for (size_t column = 0; column < bins.size(); column++)
+	{
+		const std::vector<PythagorasSquare>& squares = bins[column];
+		pool.submit([=, &squares, &layout, &shading]
+		{
+			renderPosterTile(squares, layout, shading, static_cast<int>(column) * layout.tile_size, first_row, last_row, image);
+		});
+	}
+}
+
+bool renderPoster(const Options& options)
+{
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return false;
+
+	if (!checkPythagorasTreeArguments(settings.side, settings.angle, settings.iters))
+		return false;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// The 2D view of the headless options is cut into bands of tiles, in model coordinates of the tree.
+	PosterLayout layout;
+	layout.width = options.width;
+	layout.height = options.height;
+	layout.tile_size = options.tile_size;
+	layout.supersampling = options.supersampling;
+	layout.pixel_size = static_cast<double>(options.ortho_width) / options.width;
+	layout.top_left = glm::dvec2(options.ortho_position.x - options.ortho_width / 2.0 + settings.side / 2.0,
+	                             options.ortho_position.y + layout.pixel_size * options.height / 2.0 + 0.5);
+	layout.lod_pixels = settings.lod_pixels;
+
+	PythagorasSpatialIndex index;
+	buildPythagorasSpatialIndex(settings.side, settings.angle, settings.iters, settings.reversing, index);
+
+	SceneShading shading;
+	shading.depth = settings.depth;
+	shading.last_iter = settings.iters;
+	shading.first_color = settings.first_color;
+	shading.last_color = settings.last_color;
+	shading.is_directed_light = settings.is_directed_light;
+	shading.light_direction = glm::vec3(0.f, 0.f, -1.f);
+
+	const int columns = (layout.width + layout.tile_size - 1) / layout.tile_size;
+	const int bands = (layout.height + layout.tile_size - 1) / layout.tile_size;
+
+	ImageWriter writer;
+	if (!writer.open(options.output, layout.width, layout.height))
+		return false;
+
+	// Band N + 1 is binned while band N is drawn, and band N is written while band N + 1 is drawn, so two bands of
+	// squares and pixels are all the memory the poster takes.
+	std::vector<std::vector<PythagorasSquare>> bins[2];
+	std::vector<unsigned char> images[2];
+	for (int i = 0; i < 2; i++)
+	{
+		bins[i].resize(columns);
+		images[i].resize(static_cast<size_t>(layout.width) * std::min(layout.tile_size, layout.height) * 3);
+	}
+
+	WorkStealingPool pool(generationThreads(settings.threads));
+
+	binPythagorasTree(index, layout, 0, std::min(layout.tile_size, layout.height), bins[0]);
+	submitPosterBand(pool, bins[0], layout, shading, 0, images[0].data());
+
+	for (int band = 0; band < bands; band++)
+	{
+		const int first_row = band * layout.tile_size;
+		const int rows = std::min(layout.tile_size, layout.height - first_row);
+
+		if (band + 1 < bands)
+		{
+			binPythagorasTree(index, layout, first_row + rows, std::min(first_row + rows + layout.tile_size, layout.height), bins[(band + 1) % 2]);
+		}
+
+		pool.wait();
+		if (band + 1 < bands)
+			submitPosterBand(pool, bins[(band + 1) % 2], layout, shading, band + 1, images[(band + 1) % 2].data());
+
+		if (!writer.writeRows(images[band % 2].data(), rows))
+		{
+			pool.wait();
+			return false;
+		}
+	}
+
+	if (!writer.close())
+		return false;
+
+	std::cout.precision(1);
+	std::cout << std::fixed << "Rendered " + options.output + " in " << elapsedMilliseconds(start) / 1000.0 << " s" << std::endl;
+
+	return true;
+}
+
+bool runBenchmark(const Options& options)
+{
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return false;
+
+	std::ofstream file;
+	if (!options.benchmark_output.empty())
+	{
+		file.open(options.benchmark_output);
+		if (!file.good())
+		{
+			std::cerr << "Cannot open " + options.benchmark_output + " benchmark file" << std::endl;
+			return false;
+		}
+	}
+	std::ostream& out = options.benchmark_output.empty() ? std::cout : file;
+
+	const bool is_json = options.benchmark_format == "json";
+	if (is_json)
+		out << "[";
+	else
+		out << "iterations,angle,reversing,squares,generation_ms,buffer_bytes,peak_memory_bytes,upload_bytes,frame_ms" << std::endl;
+
+	glm::vec3 camera_position(0.f, 0.f, options.camera_distance);
+	camera_position = glm::rotate(camera_position, glm::radians(options.camera_pitch), glm::vec3(-1.f, 0.f, 0.f));
+	camera_position = glm::rotate(camera_position, glm::radians(options.camera_yaw), glm::vec3(0.f, 1.f, 0.f));
+
+	const float window_ratio = static_cast<float>(options.width) / options.height;
+	const glm::mat4 mvp = treeMvpMatrix(settings.is_3d, camera_position, options.ortho_position, options.ortho_width, options.ortho_width / window_ratio, window_ratio, settings.side);
+
+	bool is_first = true;
+
+	for (size_t r = 0; r < options.benchmark_reversing.size(); r++)
+	{
+		for (size_t a = 0; a < options.benchmark_angles.size(); a++)
+		{
+			for (int i = options.benchmark_first_iters; i <= options.benchmark_last_iters; i++)
+			{
+				std::vector<PythagorasSquare> squares;
+
+				const std::chrono::steady_clock::time_point generation_start = std::chrono::steady_clock::now();
+				if (!genPythagorasSquares(settings.side, options.benchmark_angles[a], i, options.benchmark_reversing[r], settings.threads, squares, NULL))
+					return false;
+				const double generation_ms = elapsedMilliseconds(generation_start);
+
+				const size_t buffer_bytes = squares.size() * sizeof(PythagorasSquare);
+				const size_t upload_bytes = buffer_bytes + sizeof(cube_elements);
+
+				double frame_ms = 0.0;
+				if (options.benchmark_frames > 0)
+				{
+					SceneShading shading;
+					shading.depth = settings.depth;
+					shading.last_iter = i;
+					shading.first_color = settings.first_color;
+					shading.last_color = settings.last_color;
+					shading.is_directed_light = settings.is_directed_light;
+					shading.light_direction = glm::vec3(0.f, 0.f, -1.f);
+
+					PythagorasTreeLod lod;
+					buildPythagorasTreeLod(squares.data(), i, lod);
+					std::vector<PythagorasRange> ranges;
+
+					const glm::vec2 viewport(options.width * options.supersampling, options.height * options.supersampling);
+					SoftwareRasterizer rasterizer(static_cast<int>(viewport.x), static_cast<int>(viewport.y));
+
+					const std::chrono::steady_clock::time_point frames_start = std::chrono::steady_clock::now();
+					for (int frame = 0; frame < options.benchmark_frames; frame++)
+					{
+						selectPythagorasTreeRanges(lod, mvp, viewport, settings.lod_pixels, settings.depth, ranges);
+
+						rasterizer.clear();
+						for (size_t range = 0; range < ranges.size(); range++)
+							rasterizer.drawSquares(&squares[ranges[range].first], ranges[range].count, mvp, shading);
+					}
+					frame_ms = elapsedMilliseconds(frames_start) / options.benchmark_frames;
+				}
+
+				const size_t peak_memory = peakMemoryUsage();
+
+				if (is_json)
+				{
+					out << (is_first ? "\n" : ",\n")
+					    << "  {\"iterations\": " << i
+					    << ", \"angle\": " << options.benchmark_angles[a]
+					    << ", \"reversing\": " << (options.benchmark_reversing[r] ? "true" : "false")
+					    << ", \"squares\": " << squares.size()
+					    << ", \"generation_ms\": " << generation_ms
+					    << ", \"buffer_bytes\": " << buffer_bytes
+					    << ", \"peak_memory_bytes\": " << peak_memory
+					    << ", \"upload_bytes\": " << upload_bytes;
+					if (options.benchmark_frames > 0)
+						out << ", \"frame_ms\": " << frame_ms;
+					out << "}";
+				}
+				else
+				{
+					out << i << ","
+					    << options.benchmark_angles[a] << ","
+					    << (options.benchmark_reversing[r] ? "true" : "false") << ","
+					    << squares.size() << ","
+					    << generation_ms << ","
+					    << buffer_bytes << ","
+					    << peak_memory << ","
+					    << upload_bytes << ",";
+					if (options.benchmark_frames > 0)
+						out << frame_ms;
+					out << std::endl;
+				}
+
+				is_first = false;
+			}
+		}
+	}
+
+	if (is_json)
+		out << "\n]" << std::endl;
+
+	return out.good();
+}
+
+bool exportTree(const Options& options)
+{
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return false;
+
+	const size_t dot = options.export_file.find_last_of('.');
+	const std::string extension = dot == std::string::npos ? "" : options.export_file.substr(dot + 1);
+	if (extension == "svg" || extension == "SVG" || extension == "pdf" || extension == "PDF")
+		return exportPythagorasDrawing(options.export_file, settings.side, settings.angle, settings.iters, settings.reversing, settings.first_color,
+		                               settings.last_color, options.export_width, options.export_min_side);
+
+	return exportPythagorasTree(options.export_file, settings.side, settings.depth, settings.angle, settings.iters, settings.reversing);
+}
+
+bool analyzeTree(const Options& options)
+{
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return false;
+
+	if (!checkPythagorasTreeArguments(settings.side, settings.angle, settings.iters))
+		return false;
+
+	PythagorasTreeStats stats;
+	analyzePythagorasTree(settings.side, settings.angle, settings.iters, settings.reversing, stats);
+
+	std::cout << "Bounds: " << stats.bounds.x << ", " << stats.bounds.y << " to " << stats.bounds.z << ", " << stats.bounds.w << std::endl;
+	std::cout << "Area of all squares: " << stats.area << std::endl;
+	std::cout << "Level\tSquares\tSmallest side\tLargest side" << std::endl;
+	for (int iter = 1; iter <= settings.iters; iter++)
+	{
+		std::cout << iter << "\t" << stats.level_squares[iter - 1] << "\t" << stats.level_min_sides[iter - 1] << "\t"
+		          << stats.level_max_sides[iter - 1] << std::endl;
+	}
+
+	return true;
+}
+
+bool queryTree(const Options& options)
+{
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return false;
+
+	if (!checkPythagorasTreeArguments(settings.side, settings.angle, settings.iters))
+		return false;
+
+	PythagorasSpatialIndex index;
+	buildPythagorasSpatialIndex(settings.side, settings.angle, settings.iters, settings.reversing, index);
+
+	// Points are given where treeMvpMatrix places the tree, like --ortho-position.
+	const glm::dvec2 offset(settings.side / 2.0, 0.5);
+
+	if (options.is_picking)
+	{
+		PythagorasHit hit;
+		nearestPythagorasSquare(index, glm::dvec2(options.pick_point) + offset, hit);
+
+		if (hit.distance == 0.0)
+			std::cout << describePythagorasNode(hit.node, settings.side) << std::endl;
+		else
+		{
+			std::cout << "No square at " << options.pick_point.x << ", " << options.pick_point.y << std::endl;
+			std::cout << "Nearest: " << describePythagorasNode(hit.node, settings.side) << ", distance " << hit.distance << std::endl;
+		}
+	}
+
+	if (options.is_querying)
+	{
+		const glm::dvec2 min = glm::dvec2(glm::min(options.query_min, options.query_max)) + offset;
+		const glm::dvec2 max = glm::dvec2(glm::max(options.query_min, options.query_max)) + offset;
+
+		std::vector<size_t> level_squares(settings.iters, 0);
+		queryPythagorasSquares(index, min, max, [&](const PythagorasIndexNode& node)
+		{
+			level_squares[node.iter - 1]++;
+		});
+
+		size_t squares = 0;
+		for (int iter = 1; iter <= settings.iters; iter++)
+			squares += level_squares[iter - 1];
+
+		std::cout << "Squares overlapping the rectangle: " << squares << std::endl;
+		std::cout << "Level\tSquares" << std::endl;
+		for (int iter = 1; iter <= settings.iters; iter++)
+		{
+			if (level_squares[iter - 1] != 0)
+				std::cout << iter << "\t" << level_squares[iter - 1] << std::endl;
+		}
+	}
+
+	return true;
+}
+
+bool streamTree(const Options& options)
+{
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return false;
+
+	return streamPythagorasTree(options.stream_file, settings.side, settings.angle, settings.iters, settings.reversing, settings.threads, options.stream_memory << 20);
+}
+
+bool createTreeProgram(const std::string& vertex_shader_file, ShaderProgram& program)
+{
+	GLuint vert_shader;
+	if (!createShader(vertex_shader_file, GL_VERTEX_SHADER, vert_shader))
+		return false;
+
+	GLuint frag_shader;
+	if (!createShader("pt_fragment_shader.frag", GL_FRAGMENT_SHADER, frag_shader))
+		return false;
+
+	std::vector<GLuint> shaders;
+	shaders.push_back(vert_shader);
+	shaders.push_back(frag_shader);
+
+	return createShaderProgram(shaders, std::vector<const GLchar*>(), program);
+}
+
+void enablePythagorasInstances(const ShaderProgram& program, const bool is_compact_mesh)
+{
+	// Divisors and enabled arrays belong to the vertex array, so they are set once before the ranges are drawn.
+	const PythagorasInstanceLocations& locations = program.instances;
+	const GLint compact_locations[2] = { locations.corners, locations.iter };
+	const GLint square_locations[4] = { locations.origin, locations.rotation, locations.side, locations.iter };
+
+	const GLint* const used_locations = is_compact_mesh ? compact_locations : square_locations;
+	const int used_count = is_compact_mesh ? 2 : 4;
+	for (int i = 0; i < used_count; i++)
+	{
+		if (used_locations[i] == -1)
+			continue;
+
+		glVertexAttribDivisor(used_locations[i], 1);
+		glEnableVertexAttribArray(used_locations[i]);
+	}
+}
+
+void bindPythagorasInstances(const ShaderProgram& program,
+                             const bool           is_compact_mesh,
+                             const bool           is_long_index,
+                             const GLuint         squares_buffer,
+                             const GLuint         iters_buffer,
+                             const size_t         first)
+{
+	// OpenGL 3.3 has no base instance, so a range of squares is drawn by offsetting the instance attributes.
+	const PythagorasInstanceLocations& locations = program.instances;
+	glBindBuffer(GL_ARRAY_BUFFER, squares_buffer);
+
+	if (is_compact_mesh)
+	{
+		glVertexAttribIPointer(locations.corners, 4, is_long_index ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, 0,
+		                       reinterpret_cast<const GLvoid*>(first * 4 * (is_long_index ? sizeof(GLuint) : sizeof(GLushort))));
+
+		glBindBuffer(GL_ARRAY_BUFFER, iters_buffer);
+		glVertexAttribIPointer(locations.iter, 1, GL_UNSIGNED_BYTE, 0, reinterpret_cast<const GLvoid*>(first));
+	}
+	else
+	{
+		const size_t offset = first * sizeof(PythagorasSquare);
+
+		glVertexAttribPointer(locations.origin, 2, GL_FLOAT, GL_FALSE, sizeof(PythagorasSquare), reinterpret_cast<const GLvoid*>(offset + offsetof(PythagorasSquare, x)));
+		glVertexAttribPointer(locations.rotation, 1, GL_FLOAT, GL_FALSE, sizeof(PythagorasSquare), reinterpret_cast<const GLvoid*>(offset + offsetof(PythagorasSquare, rotation)));
+		glVertexAttribPointer(locations.side, 1, GL_FLOAT, GL_FALSE, sizeof(PythagorasSquare), reinterpret_cast<const GLvoid*>(offset + offsetof(PythagorasSquare, side)));
+		glVertexAttribIPointer(locations.iter, 1, GL_INT, sizeof(PythagorasSquare), reinterpret_cast<const GLvoid*>(offset + offsetof(PythagorasSquare, iter)));
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+struct PythagorasGpuGenerator
+{
+	bool          is_compute;
+	ShaderProgram program;
+	GLuint        vertex_array;
+	GLuint        feedback_buffer;
+	size_t        chunk;
+	size_t        alignment;
+	GLint         reversing_location;
+	GLint         parent_iter_location;
+	GLint         angle_location;
+	GLint         parent_skew_location;
+	GLint         child_skew_location;
+	GLint         count_location;
+};
+
+bool createPythagorasGpuGenerator(const bool is_compute, PythagorasGpuGenerator& generator)
+{
+	generator.is_compute = is_compute;
+
+	GLuint shader;
+	if (!createShader(is_compute ? "pt_generator.comp" : "pt_generator.vert", is_compute ? GL_COMPUTE_SHADER : GL_VERTEX_SHADER, shader))
+		return false;
+
+	// The varyings are captured interleaved in the layout of PythagorasSquare.
+	std::vector<const GLchar*> feedback_varyings;
+	if (!is_compute)
+	{
+		feedback_varyings.push_back("out_origin");
+		feedback_varyings.push_back("out_rotation");
+		feedback_varyings.push_back("out_side");
+		feedback_varyings.push_back("out_iter");
+	}
+
+	if (!createShaderProgram(std::vector<GLuint>(1, shader), feedback_varyings, generator.program))
+		return false;
+
+	generator.reversing_location = uniformLocation(generator.program, "reversing");
+	generator.parent_iter_location = uniformLocation(generator.program, "parent_iter");
+	generator.angle_location = uniformLocation(generator.program, "angle");
+	generator.parent_skew_location = uniformLocation(generator.program, "parent_skew");
+	generator.child_skew_location = uniformLocation(generator.program, "child_skew");
+	generator.count_location = uniformLocation(generator.program, "count");
+
+	// Levels are expanded in chunks small enough for one dispatch and one storage block binding.
+	generator.chunk = static_cast<size_t>(1) << 21;
+	generator.alignment = 1;
+	if (is_compute)
+	{
+		GLint max_block_size;
+		glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+
+		GLint alignment;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		generator.alignment = alignment;
+
+		while (generator.chunk > 2 && generator.chunk * sizeof(PythagorasSquare) + generator.alignment > static_cast<size_t>(max_block_size))
+			generator.chunk /= 2;
+	}
+
+	glGenVertexArrays(1, &generator.vertex_array);
+	glGenBuffers(1, &generator.feedback_buffer);
+
+	if (!is_compute)
+	{
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, generator.feedback_buffer);
+		glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, generator.chunk * sizeof(PythagorasSquare), NULL, GL_STREAM_COPY);
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+	}
+
+	GLenum error;
+	if ((error = glGetError()) != GL_NO_ERROR)
+	{
+		std::cerr << "GPU generator error: " << error << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void _bindPythagorasLevel(const GLuint buffer, const GLuint binding, const size_t first, const size_t count, const size_t alignment, GLuint& skew)
+{
+	// Storage blocks can only start at aligned offsets, so the level is bound from the offset below it.
+	const size_t offset = first * sizeof(PythagorasSquare);
+	const size_t aligned_offset = offset - offset % alignment;
+	skew = static_cast<GLuint>((offset - aligned_offset) / sizeof(GLuint));
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, aligned_offset, offset + count * sizeof(PythagorasSquare) - aligned_offset);
+}
+
+bool genPythagorasSquaresGpu(const PythagorasGpuGenerator& generator,
+                             const GLfloat                 side,
+                             const float                   angle,
+                             const int                     first_iters,
+                             const int                     iters,
+                             const bool                    reversing,
+                             const GLuint                  squares_buffer)
+{
+	if (!checkPythagorasTreeArguments(side, angle, iters))
+		return false;
+
+	// The buffer has to hold pythagorasTreeSize(iters) squares, of which the first first_iters levels are kept.
+	if (first_iters == 0)
+	{
+		const PythagorasSquare root = { 0.f, 0.f, 0.f, side, 1 };
+		glBindBuffer(GL_ARRAY_BUFFER, squares_buffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(PythagorasSquare), &root);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	const ShaderProgram& program = generator.program;
+	glUseProgram(program.id);
+	glUniform1i(generator.reversing_location, reversing);
+
+	if (!generator.is_compute)
+	{
+		glBindVertexArray(generator.vertex_array);
+		enablePythagorasInstances(program, false);
+		glEnable(GL_RASTERIZER_DISCARD);
+	}
+
+	for (int iter = std::max(first_iters, 1); iter < iters; iter++)
+	{
+		const size_t parents_first = pythagorasTreeSize(iter - 1);
+		const size_t children_first = pythagorasTreeSize(iter);
+		const size_t children = static_cast<size_t>(1) << iter;
+
+		glUniform1i(generator.parent_iter_location, iter);
+		glUniform1f(generator.angle_location, pythagorasLevelAngle(angle, iter, reversing));
+
+		for (size_t first = 0; first < children; first += generator.chunk)
+		{
+			const size_t count = std::min(generator.chunk, children - first);
+
+			if (generator.is_compute)
+			{
+				GLuint parent_skew;
+				GLuint child_skew;
+				_bindPythagorasLevel(squares_buffer, 0, parents_first + first / 2, count / 2, generator.alignment, parent_skew);
+				_bindPythagorasLevel(squares_buffer, 1, children_first + first, count, generator.alignment, child_skew);
+
+				glUniform1ui(generator.parent_skew_location, parent_skew);
+				glUniform1ui(generator.child_skew_location, child_skew);
+				glUniform1ui(generator.count_location, static_cast<GLuint>(count));
+				glDispatchCompute(static_cast<GLuint>((count + 63) / 64), 1, 1);
+			}
+			else
+			{
+				bindPythagorasInstances(program, false, false, squares_buffer, 0, parents_first + first / 2);
+
+				glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, generator.feedback_buffer, 0, count * sizeof(PythagorasSquare));
+				glBeginTransformFeedback(GL_POINTS);
+				glDrawArraysInstanced(GL_POINTS, 0, 2, static_cast<GLsizei>(count / 2));
+				glEndTransformFeedback();
+				glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+				glBindBuffer(GL_COPY_READ_BUFFER, generator.feedback_buffer);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, squares_buffer);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, (children_first + first) * sizeof(PythagorasSquare), count * sizeof(PythagorasSquare));
+				glBindBuffer(GL_COPY_READ_BUFFER, 0);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			}
+		}
+
+		// The next level reads the squares this one wrote.
+		if (generator.is_compute)
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	if (generator.is_compute)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+		glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}
+	else
+	{
+		glDisable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(0);
+	}
+
+	glUseProgram(0);
+
+	GLenum error;
+	if ((error = glGetError()) != GL_NO_ERROR)
+	{
+		std::cerr << "GPU generation error: " << error << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool verifyGpuGeneration(const GLfloat side, const float angle, const int iters, const bool reversing, const unsigned int threads)
+{
+	std::vector<PythagorasSquare> squares;
+
+	const std::chrono::steady_clock::time_point cpu_start = std::chrono::steady_clock::now();
+	if (!genPythagorasSquares(side, angle, iters, reversing, threads, squares, NULL))
+		return false;
+	const double cpu_ms = elapsedMilliseconds(cpu_start);
+
+	std::cerr << "cpu: " << cpu_ms << " ms" << std::endl;
+
+	bool is_equal = true;
+
+	for (int backend = GLEW_VERSION_4_3 ? 0 : 1; backend < 2; backend++)
+	{
+		const bool is_compute = backend == 0;
+
+		PythagorasGpuGenerator generator;
+		if (!createPythagorasGpuGenerator(is_compute, generator))
+			return false;
+
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, squares.size() * sizeof(PythagorasSquare), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glFinish();
+		const std::chrono::steady_clock::time_point gpu_start = std::chrono::steady_clock::now();
+		if (!genPythagorasSquaresGpu(generator, side, angle, 0, iters, reversing, buffer))
+			return false;
+		glFinish();
+		const double gpu_ms = elapsedMilliseconds(gpu_start);
+
+		std::vector<PythagorasSquare> gpu_squares(squares.size());
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, gpu_squares.size() * sizeof(PythagorasSquare), gpu_squares.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDeleteBuffers(1, &buffer);
+
+		// GPU sines and cosines are not those of the CPU, so positions are compared relative to the root side.
+		float max_position_error = 0.f;
+		float max_rotation_error = 0.f;
+		size_t wrong_iters = 0;
+		for (size_t i = 0; i < squares.size(); i++)
+		{
+			const PythagorasSquare& a = squares[i];
+			const PythagorasSquare& b = gpu_squares[i];
+
+			max_position_error = std::max(max_position_error, std::max(std::abs(a.x - b.x), std::abs(a.y - b.y)) / side);
+			max_position_error = std::max(max_position_error, std::abs(a.side - b.side) / side);
+			max_rotation_error = std::max(max_rotation_error, std::abs(a.rotation - b.rotation));
+			if (a.iter != b.iter)
+				wrong_iters++;
+		}
+
+		std::cerr << (is_compute ? "compute: " : "transform feedback: ") << gpu_ms << " ms, max position error " << max_position_error
+		          << ", max rotation error " << max_rotation_error << " deg, wrong iterations " << wrong_iters << std::endl;
+
+		if (max_position_error > 1e-4f || max_rotation_error > 1e-2f || wrong_iters != 0)
+			is_equal = false;
+	}
+
+	if (!is_equal)
+		std::cerr << "GPU generation differs from CPU generation" << std::endl;
+
+	return is_equal;
+}
+
+struct MappedFile
+{
+	const unsigned char* data;
+	size_t               size;
+#if defined(_WIN32)
+	HANDLE               file;
+	HANDLE               mapping;
+#else
+	int                  file;
+#endif
+};
+
+bool mapFile(const std::string& file_name, MappedFile& mapped)
+{
+	mapped.data = NULL;
+	mapped.size = 0;
+
+#if defined(_WIN32)
+	mapped.file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapped.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped.file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(mapped.file);
+		return false;
+	}
+
+	mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapped.mapping == NULL)
+	{
+		CloseHandle(mapped.file);
+		return false;
+	}
+
+	mapped.data = static_cast<const unsigned char*>(MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0));
+	if (mapped.data == NULL)
+	{
+		CloseHandle(mapped.mapping);
+		CloseHandle(mapped.file);
+		return false;
+	}
+
+	mapped.size = static_cast<size_t>(size.QuadPart);
+#else
+	mapped.file = open(file_name.c_str(), O_RDONLY);
+	if (mapped.file == -1)
+		return false;
+
+	struct stat info;
+	if (fstat(mapped.file, &info) != 0 || info.st_size == 0)
+	{
+		close(mapped.file);
+		return false;
+	}
+
+	void* const data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, mapped.file, 0);
+	if (data == MAP_FAILED)
+	{
+		close(mapped.file);
+		return false;
+	}
+
+	mapped.data = static_cast<const unsigned char*>(data);
+	mapped.size = info.st_size;
+#endif
+
+	return true;
+}
+
+void unmapFile(MappedFile& mapped)
+{
+	if (mapped.data == NULL)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(mapped.data);
+	CloseHandle(mapped.mapping);
+	CloseHandle(mapped.file);
+#else
+	munmap(const_cast<unsigned char*>(mapped.data), mapped.size);
+	close(mapped.file);
+#endif
+
+	mapped.data = NULL;
+	mapped.size = 0;
+}
+
+// The cache holds the squares in the layout of this build, so it is only valid for the machine that wrote it.
+struct PythagorasCacheHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t square_size;
+	uint32_t iters;
+	float    side;
+	float    angle;
+	uint32_t reversing;
+	uint64_t count;
+};
+
+const uint32_t pythagoras_cache_version = 2;
+
+PythagorasCacheHeader pythagorasCacheHeader(const GLfloat side, const float angle, const int iters, const bool reversing)
+{
+	PythagorasCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, "PTCACHE", 8);
+	header.version = pythagoras_cache_version;
+	header.square_size = sizeof(PythagorasSquare);
+	header.iters = iters;
+	header.side = side;
+	header.angle = angle;
+	header.reversing = reversing;
+	header.count = pythagorasTreeSize(iters);
+
+	return header;
+}
+
+std::string pythagorasCacheFile(const std::string& directory, const GLfloat side, const float angle, const int iters, const bool reversing)
+{
+	// FNV-1a of the header, which holds every setting that changes the squares.
+	const PythagorasCacheHeader header = pythagorasCacheHeader(side, angle, iters, reversing);
+	const unsigned char* const bytes = reinterpret_cast<const unsigned char*>(&header);
+
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(header); i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+	std::stringstream sstream;
+	sstream << directory << "/pythagoras_tree_" << std::hex << hash << ".cache";
+
+	return sstream.str();
+}
+
+bool mapPythagorasCache(const std::string& directory, const GLfloat side, const float angle, const int iters, const bool reversing, MappedFile& cache)
+{
+	if (!mapFile(pythagorasCacheFile(directory, side, angle, iters, reversing), cache))
+		return false;
+
+	const PythagorasCacheHeader header = pythagorasCacheHeader(side, angle, iters, reversing);
+	if (cache.size != sizeof(header) + header.count * sizeof(PythagorasSquare) || std::memcmp(cache.data, &header, sizeof(header)) != 0)
+	{
+		unmapFile(cache);
+		return false;
+	}
+
+	return true;
+}
+
+const PythagorasSquare* pythagorasCacheSquares(const MappedFile& cache)
+{
+	return reinterpret_cast<const PythagorasSquare*>(cache.data + sizeof(PythagorasCacheHeader));
+}
+
+void prunePythagorasCache(const std::string& directory, const unsigned int files, const std::string& kept_file_name)
+{
+	// Only the newest files are kept, always including the one just written; a limit of 0 keeps all of them.
+	if (files == 0)
+		return;
+
+	std::vector<std::string> names;
+#if defined(_WIN32)
+	WIN32_FIND_DATAA data;
+	const HANDLE find = FindFirstFileA((directory + "/pythagoras_tree_*.cache").c_str(), &data);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+			names.push_back(data.cFileName);
+		while (FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	DIR* const dir = opendir(directory.c_str());
+	if (dir != NULL)
+	{
+		const std::string prefix = "pythagoras_tree_";
+		const std::string suffix = ".cache";
+		while (const dirent* const entry = readdir(dir))
+		{
+			const std::string name = entry->d_name;
+			if (name.size() > prefix.size() + suffix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+			    name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+			{
+				names.push_back(name);
+			}
+		}
+		closedir(dir);
+	}
+#endif
+
+	std::vector<std::pair<time_t, std::string>> caches;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		const std::string file_name = directory + "/" + names[i];
+		struct stat info;
+		if (file_name != kept_file_name && stat(file_name.c_str(), &info) == 0)
+			caches.push_back(std::make_pair(info.st_mtime, file_name));
+	}
+
+	if (caches.size() < files)
+		return;
+
+	std::sort(caches.begin(), caches.end());
+	for (size_t i = 0; i + files <= caches.size(); i++)
+		std::remove(caches[i].second.c_str());
+}
+
+bool savePythagorasCache(const std::string&                   directory,
+                         const unsigned int                   files,
+                         const GLfloat                        side,
+                         const float                          angle,
+                         const int                            iters,
+                         const bool                           reversing,
+                         const std::vector<PythagorasSquare>& squares)
+{
+	// Written under a temporary name first, so an interrupted write never leaves a cache that looks valid.
+	const std::string file_name = pythagorasCacheFile(directory, side, angle, iters, reversing);
+	const std::string temporary_name = file_name + ".tmp";
+
+#if defined(_WIN32)
+	CreateDirectoryA(directory.c_str(), NULL);
+#else
+	mkdir(directory.c_str(), 0777);
+#endif
+
+	std::ofstream file(temporary_name, std::ios::binary);
+	if (!file.good())
+	{
+		std::cerr << "Cannot create " + temporary_name + " cache file" << std::endl;
+		return false;
+	}
+
+	const PythagorasCacheHeader header = pythagorasCacheHeader(side, angle, iters, reversing);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(squares.data()), squares.size() * sizeof(PythagorasSquare));
+	file.close();
+
+	if (!file || std::rename(temporary_name.c_str(), file_name.c_str()) != 0)
+	{
+		std::cerr << "Cannot write " + file_name + " cache file" << std::endl;
+		std::remove(temporary_name.c_str());
+		return false;
+	}
+
+	prunePythagorasCache(directory, files, file_name);
+
+	return true;
+}
+
+const char* const profile_phase_names[] =
+{
+	"Events",
+	"Camera",
+	"Upload",
+	"Uniforms",
+	"Draw",
+	"Swap",
+	"Generate",
+	"Level",
+	"LOD"
+};
+
+const int profile_phases = sizeof(profile_phase_names) / sizeof(profile_phase_names[0]);
+
+// Phases of a frame come first, in the order they run; the rest are spent generating trees.
+const int profile_events = 0;
+const int profile_camera = 1;
+const int profile_upload = 2;
+const int profile_uniforms = 3;
+const int profile_draw = 4;
+const int profile_swap = 5;
+const int profile_generate = 6;
+const int profile_level = 7;
+const int profile_lod = 8;
+const int profile_frame_phases = 6;
+
+// Trace thread ids of the render loop, the tree builder and the graphics card.
+const int profile_main_track = 1;
+const int profile_builder_track = 2;
+const int profile_gpu_track = 3;
+
+struct ProfileEvent
+{
+	int    phase;
+	int    track;
+	double start;
+	double duration;
+};
+
+struct ProfileCounter
+{
+	double start;
+	size_t draw_calls;
+	size_t triangles;
+};
+
+struct ProfileQuery
+{
+	GLuint id;
+	int    phase;
+	double start;
+};
+
+class Profiler
+{
+public:
+	Profiler();
+
+	void start(const bool is_reporting, const bool is_tracing);
+	bool isEnabled() const;
+	double now() const;
+
+	// Phases of the render thread; a phase timed on the graphics card too may not contain another such phase.
+	void begin(const int phase, const bool is_gpu_timed);
+	void end(const int phase);
+	void record(const int phase, const int track, const double start, const double duration);
+	void endFrame(sf::Window& window, const size_t draw_calls, const size_t triangles);
+
+	// Waits for the last timer queries, so it has to be called while the context still exists.
+	bool finish(const std::string& trace_file);
+
+private:
+	void collectQueries(const bool is_waiting);
+	std::string summary(std::vector<double>& frame_times, const double seconds) const;
+	bool writeTrace(const std::string& file_name) const;
+
+	bool                                  is_enabled;
+	bool                                  is_reporting;
+	bool                                  is_tracing;
+	std::chrono::steady_clock::time_point origin;
+	double                                phase_starts[profile_phases];
+	std::deque<ProfileQuery>              queries;
+	std::vector<GLuint>                   free_queries;
+	bool                                  is_query_active;
+
+	// Times are in microseconds from the start; the totals cover the frames since the last report.
+	std::mutex                            mutex;
+	double                                cpu_totals[profile_phases];
+	double                                gpu_totals[profile_phases];
+	int                                   gpu_frames[profile_phases];
+	size_t                                interval_draw_calls;
+	size_t                                interval_triangles;
+	double                                interval_start;
+	double                                last_frame;
+	std::vector<double>                   interval_frame_times;
+	std::vector<double>                   frame_times;
+	std::vector<ProfileEvent>             events;
+	std::vector<ProfileCounter>           counters;
+};
+
+Profiler::Profiler()
+	: is_enabled(false), is_reporting(false), is_tracing(false), is_query_active(false)
+{
+}
+
+void Profiler::start(const bool is_reporting, const bool is_tracing)
+{
+	this->is_reporting = is_reporting;
+	this->is_tracing = is_tracing;
+	is_enabled = is_reporting || is_tracing;
+
+	origin = std::chrono::steady_clock::now();
+	std::fill(phase_starts, phase_starts + profile_phases, 0.0);
+	std::fill(cpu_totals, cpu_totals + profile_phases, 0.0);
+	std::fill(gpu_totals, gpu_totals + profile_phases, 0.0);
+	std::fill(gpu_frames, gpu_frames + profile_phases, 0);
+	interval_draw_calls = 0;
+	interval_triangles = 0;
+	interval_start = 0.0;
+	last_frame = 0.0;
+}
+
+bool Profiler::isEnabled() const
+{
+	return is_enabled;
+}
+
+double Profiler::now() const
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void Profiler::begin(const int phase, const bool is_gpu_timed)
+{
+	if (!is_enabled)
+		return;
+
+	phase_starts[phase] = now();
+
+	if (is_gpu_timed && !is_query_active)
+	{
+		ProfileQuery query;
+		if (free_queries.empty())
+			glGenQueries(1, &query.id);
+		else
+		{
+			query.id = free_queries.back();
+			free_queries.pop_back();
+		}
+		query.phase = phase;
+		query.start = phase_starts[phase];
+
+		glBeginQuery(GL_TIME_ELAPSED, query.id);
+		queries.push_back(query);
+		is_query_active = true;
+	}
+}
+
+void Profiler::end(const int phase)
+{
+	if (!is_enabled)
+		return;
+
+	if (is_query_active && queries.back().phase == phase)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		is_query_active = false;
+	}
+
+	record(phase, profile_main_track, phase_starts[phase], now() - phase_starts[phase]);
+}
+
+void Profiler::record(const int phase, const int track, const double start, const double duration)
+{
+	if (!is_enabled)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (track != profile_gpu_track)
+		cpu_totals[phase] += duration;
+
+	if (is_tracing)
+	{
+		ProfileEvent event;
+		event.phase = phase;
+		event.track = track;
+		event.start = start;
+		event.duration = duration;
+		events.push_back(event);
+	}
+}
+
+void Profiler::collectQueries(const bool is_waiting)
+{
+	// Results come in the order the queries were issued; without waiting, the ones still running are left for a
+	// later frame so reading them never stalls the pipeline.
+	while (!queries.empty() && !(is_query_active && queries.size() == 1))
+	{
+		const ProfileQuery& query = queries.front();
+
+		GLuint is_available = GL_TRUE;
+		if (!is_waiting)
+			glGetQueryObjectuiv(query.id, GL_QUERY_RESULT_AVAILABLE, &is_available);
+		if (!is_available)
+			break;
+
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &elapsed);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			gpu_totals[query.phase] += elapsed / 1000.0;
+			gpu_frames[query.phase]++;
+		}
+		record(query.phase, profile_gpu_track, query.start, elapsed / 1000.0);
+
+		free_queries.push_back(query.id);
+		queries.pop_front();
+	}
+}
+
+std::string Profiler::summary(std::vector<double>& frame_times, const double seconds) const
+{
+	// Nearest rank percentiles of the frame times.
+	std::sort(frame_times.begin(), frame_times.end());
+	const size_t frames = frame_times.size();
+	const size_t p50 = (frames * 50 + 99) / 100 - 1;
+	const size_t p95 = (frames * 95 + 99) / 100 - 1;
+	const size_t p99 = (frames * 99 + 99) / 100 - 1;
+
+	std::stringstream sstream;
+	sstream.precision(2);
+	sstream << std::fixed << frames / seconds << " fps, frame p50 " << frame_times[p50] / 1000.0 << " p95 " << frame_times[p95] / 1000.0
+	        << " p99 " << frame_times[p99] / 1000.0 << " max " << frame_times.back() / 1000.0 << " ms";
+
+	return sstream.str();
+}
+
+void Profiler::endFrame(sf::Window& window, const size_t draw_calls, const size_t triangles)
+{
+	if (!is_enabled)
+		return;
+
+	collectQueries(false);
+
+	const double frame_end = now();
+	if (last_frame > 0.0)
+	{
+		interval_frame_times.push_back(frame_end - last_frame);
+		frame_times.push_back(frame_end - last_frame);
+	}
+	last_frame = frame_end;
+
+	interval_draw_calls += draw_calls;
+	interval_triangles += triangles;
+
+	if (is_tracing)
+	{
+		ProfileCounter counter;
+		counter.start = frame_end;
+		counter.draw_calls = draw_calls;
+		counter.triangles = triangles;
+		counters.push_back(counter);
+	}
+
+	if (frame_end - interval_start < 1e6 || interval_frame_times.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (is_reporting)
+	{
+		const size_t frames = interval_frame_times.size();
+		const std::string frames_summary = summary(interval_frame_times, (frame_end - interval_start) / 1e6);
+
+		// CPU time of every phase per frame, then the graphics card time of the ones it timed.
+		std::stringstream sstream;
+		sstream.precision(2);
+		sstream << std::fixed << frames_summary << " | cpu";
+		for (int phase = 0; phase < profile_frame_phases; phase++)
+			sstream << " " << profile_phase_names[phase] << " " << cpu_totals[phase] / frames / 1000.0;
+
+		sstream << " ms | gpu";
+		double gpu_frame = 0.0;
+		for (int phase = 0; phase < profile_frame_phases; phase++)
+		{
+			if (gpu_frames[phase] > 0)
+			{
+				sstream << " " << profile_phase_names[phase] << " " << gpu_totals[phase] / gpu_frames[phase] / 1000.0;
+				gpu_frame += gpu_totals[phase] / gpu_frames[phase] / 1000.0;
+			}
+		}
+
+		sstream << " ms | " << static_cast<double>(interval_draw_calls) / frames << " draw calls, " << interval_triangles / frames << " triangles";
+		if (cpu_totals[profile_generate] > 0.0)
+			sstream << " | generating " << cpu_totals[profile_generate] / 1000.0 << " ms";
+		std::cout << sstream.str() << std::endl;
+
+		std::stringstream title;
+		title.precision(2);
+		title << std::fixed << "PythagorasTree - " << frames_summary << ", gpu " << gpu_frame << " ms";
+		window.setTitle(title.str());
+	}
+
+	std::fill(cpu_totals, cpu_totals + profile_phases, 0.0);
+	std::fill(gpu_totals, gpu_totals + profile_phases, 0.0);
+	std::fill(gpu_frames, gpu_frames + profile_phases, 0);
+	interval_draw_calls = 0;
+	interval_triangles = 0;
+	interval_start = frame_end;
+	interval_frame_times.clear();
+}
+
+bool Profiler::finish(const std::string& trace_file)
+{
+	if (!is_enabled)
+		return true;
+
+	if (is_query_active)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		is_query_active = false;
+	}
+	collectQueries(true);
+
+	if (!free_queries.empty())
+		glDeleteQueries(static_cast<GLsizei>(free_queries.size()), free_queries.data());
+	free_queries.clear();
+
+	if (is_reporting && !frame_times.empty())
+	{
+		double total = 0.0;
+		for (size_t i = 0; i < frame_times.size(); i++)
+			total += frame_times[i];
+
+		std::cout << frame_times.size() << " frames, " << summary(frame_times, total / 1e6) << std::endl;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	return !is_tracing || writeTrace(trace_file);
+}
+
+bool Profiler::writeTrace(const std::string& file_name) const
+{
+	// Chrome trace event format, as read by chrome://tracing and Perfetto. Graphics card phases are placed at the
+	// time they were issued, since the timer queries only measure how long they took.
+	std::ofstream file(file_name);
+	file.precision(3);
+	file << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+
+	const char* const track_names[] = { "Render", "Builder", "GPU" };
+	const char* separator = "";
+	for (int track = profile_main_track; track <= profile_gpu_track; track++)
+	{
+		file << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track << ",\"args\":{\"name\":\""
+		     << track_names[track - profile_main_track] << "\"}}";
+		separator = ",\n";
+	}
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		file << separator << "{\"name\":\"" << profile_phase_names[events[i].phase] << "\",\"cat\":\"" << (events[i].track == profile_gpu_track ? "gpu" : "cpu")
+		     << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << events[i].track << ",\"ts\":" << events[i].start << ",\"dur\":" << events[i].duration << "}";
+	}
+
+	for (size_t i = 0; i < counters.size(); i++)
+	{
+		file << separator << "{\"name\":\"Frame\",\"ph\":\"C\",\"pid\":1,\"ts\":" << counters[i].start << ",\"args\":{\"draw calls\":"
+		     << counters[i].draw_calls << ",\"triangles\":" << counters[i].triangles << "}}";
+	}
+
+	file << std::endl << "]}" << std::endl;
+
+	if (!file)
+	{
+		std::cerr << "Cannot write " + file_name + " trace file" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Times one phase on the CPU until the end of the scope; a NULL profiler times nothing.
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler* profiler, const int phase, const int track);
+	~ProfileScope();
+
+private:
+	Profiler* profiler;
+	int       phase;
+	int       track;
+	double    start;
+};
+
+ProfileScope::ProfileScope(Profiler* profiler, const int phase, const int track)
+	: profiler(profiler && profiler->isEnabled() ? profiler : NULL), phase(phase), track(track), start(0.0)
+{
+	if (this->profiler)
+		start = this->profiler->now();
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (profiler)
+		profiler->record(phase, track, start, profiler->now() - start);
+}
+
+template<class T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(const size_t capacity);
+
+	bool push(T& item);
+	bool pop(T& item);
+
+private:
+	// One thread pushes and one pops, so each index has a single writer and no locks are needed.
+	std::vector<T>      items;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+};
+
+template<class T>
+SpscQueue<T>::SpscQueue(const size_t capacity)
+	: items(capacity + 1), head(0), tail(0)
+{
+}
+
+template<class T>
+bool SpscQueue<T>::push(T& item)
+{
+	const size_t current_tail = tail.load(std::memory_order_relaxed);
+	const size_t next_tail = (current_tail + 1) % items.size();
+	if (next_tail == head.load(std::memory_order_acquire))
+		return false;
+
+	items[current_tail] = std::move(item);
+	tail.store(next_tail, std::memory_order_release);
+	return true;
+}
+
+template<class T>
+bool SpscQueue<T>::pop(T& item)
+{
+	const size_t current_head = head.load(std::memory_order_relaxed);
+	if (current_head == tail.load(std::memory_order_acquire))
+		return false;
+
+	item = std::move(items[current_head]);
+	items[current_head] = T();
+	head.store((current_head + 1) % items.size(), std::memory_order_release);
+	return true;
+}
+
+struct PythagorasTreeJob
+{
+	unsigned int id;
+	GLfloat      side;
+	float        angle;
+	int          iters;
+	bool         reversing;
+	unsigned int threads;
+	bool         is_cached;
+	std::string  cache_directory;
+	unsigned int cache_files;
+	Profiler*    profiler;
+};
+
+// Squares of one tree shape, shared by the builder and the parts it hands over. Levels are only ever added
+// behind the ones already handed over, and the storage is reserved up front, so those stay where they are.
+struct PythagorasSquareStore
+{
+	PythagorasSquareStore();
+	~PythagorasSquareStore();
+
+	unsigned int                  shape;
+	std::vector<PythagorasSquare> squares;
+	MappedFile                    cache;
+	const PythagorasSquare*       data;
+};
+
+PythagorasSquareStore::PythagorasSquareStore()
+	: shape(0), data(NULL)
+{
+	cache.data = NULL;
+}
+
+PythagorasSquareStore::~PythagorasSquareStore()
+{
+	unmapFile(cache);
+}
+
+struct PythagorasTreePart
+{
+	unsigned int                                 id;
+	int                                          iters;
+	std::shared_ptr<const PythagorasSquareStore> store;
+	std::shared_ptr<const PythagorasTreeLod>     lod;
+};
+
+class PythagorasTreeBuilder
+{
+public:
+	PythagorasTreeBuilder();
+	~PythagorasTreeBuilder();
+
+	void request(const PythagorasTreeJob& job);
+	bool receive(PythagorasTreePart& part);
+
+private:
+	void run();
+	bool build(const PythagorasTreeJob& job);
+	bool publish(const PythagorasTreeJob& job, const std::shared_ptr<const PythagorasTreeLod>& lod);
+	bool isSuperseded(const PythagorasTreeJob& job) const;
+
+	SpscQueue<PythagorasTreePart>          parts;
+	std::mutex                             mutex;
+	std::condition_variable                job_added;
+	PythagorasTreeJob                      next_job;
+	bool                                   has_job;
+	std::atomic<unsigned int>              last_id;
+	std::atomic<bool>                      is_stopping;
+	std::thread                            worker;
+
+	// The tree the worker has built so far, with the nodes of its last level when it can be grown.
+	std::shared_ptr<PythagorasSquareStore> store;
+	PythagorasNodes                        last_level;
+	GLfloat                                side;
+	float                                  angle;
+	int                                    iters;
+	bool                                   reversing;
+	unsigned int                           shapes;
+};
+
+PythagorasTreeBuilder::PythagorasTreeBuilder()
+	: parts(64), has_job(false), last_id(0), is_stopping(false), side(0.f), angle(0.f), iters(0), reversing(false), shapes(0)
+{
+	worker = std::thread(&PythagorasTreeBuilder::run, this);
+}
+
+PythagorasTreeBuilder::~PythagorasTreeBuilder()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_stopping = true;
+	}
+	job_added.notify_all();
+
+	worker.join();
+}
+
+void PythagorasTreeBuilder::request(const PythagorasTreeJob& job)
+{
+	// Only the newest job matters; one that was not started yet is replaced and one being built is abandoned.
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		next_job = job;
+		has_job = true;
+		last_id = job.id;
+	}
+	job_added.notify_one();
+}
+
+bool PythagorasTreeBuilder::receive(PythagorasTreePart& part)
+{
+	return parts.pop(part);
+}
+
+void PythagorasTreeBuilder::run()
+{
+	while (true)
+	{
+		PythagorasTreeJob job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_added.wait(lock, [this] { return has_job || is_stopping; });
+			if (is_stopping)
+				return;
+
+			job = next_job;
+			has_job = false;
+		}
+
+		build(job);
+	}
+}
+
+bool PythagorasTreeBuilder::isSuperseded(const PythagorasTreeJob& job) const
+{
+	return job.id != last_id || is_stopping;
+}
+
+bool PythagorasTreeBuilder::publish(const PythagorasTreeJob& job, const std::shared_ptr<const PythagorasTreeLod>& lod)
+{
+	PythagorasTreePart part;
+	part.id = job.id;
+	part.iters = lod ? job.iters : iters;
+	part.store = store;
+	part.lod = lod;
+
+	while (!parts.push(part))
+	{
+		if (isSuperseded(job))
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return true;
+}
+
+bool PythagorasTreeBuilder::build(const PythagorasTreeJob& job)
+{
+	ProfileScope scope(job.profiler, profile_generate, profile_builder_track);
+
+	// The first levels are generated at once and every further one is handed over as soon as it is done, so the
+	// tree can be drawn while its last levels are still being generated.
+	const int preview_iters = 16;
+
+	const bool is_same_shape = store && job.side == side && job.angle == angle && job.reversing == reversing;
+	MappedFile cache;
+	cache.data = NULL;
+	bool is_generated = false;
+
+	if (is_same_shape && job.iters <= iters)
+	{
+		// Fewer iterations are a prefix of the squares already built.
+	}
+	else if (is_same_shape && !last_level.side.empty())
+	{
+		const size_t size = pythagorasTreeSize(job.iters);
+		if (size > store->squares.capacity())
+		{
+			// As with the GPU buffer, a growing tree gets room for one more level, so the next one is only appended.
+			const size_t capacity = 2 * size + 1;
+			if (store.use_count() > 1)
+			{
+				// Parts handed over point into the current storage, so a larger one gets a copy.
+				std::shared_ptr<PythagorasSquareStore> grown_store(new PythagorasSquareStore);
+				grown_store->shape = store->shape;
+				grown_store->squares.reserve(capacity);
+				grown_store->squares.assign(store->squares.begin(), store->squares.end());
+				store = grown_store;
+			}
+			else
+				store->squares.reserve(capacity);
+
+			store->data = store->squares.data();
+		}
+	}
+	else if (job.is_cached && mapPythagorasCache(job.cache_directory, job.side, job.angle, job.iters, job.reversing, cache))
+	{
+		store.reset(new PythagorasSquareStore);
+		store->shape = ++shapes;
+		store->cache = cache;
+		store->data = pythagorasCacheSquares(cache);
+		last_level = PythagorasNodes();
+		iters = job.iters;
+	}
+	else
+	{
+		store.reset(new PythagorasSquareStore);
+		store->shape = ++shapes;
+		store->squares.reserve(pythagorasTreeSize(job.iters));
+		store->data = store->squares.data();
+
+		iters = std::min(job.iters, preview_iters);
+		if (!genPythagorasSquares(job.side, job.angle, iters, job.reversing, job.threads, store->squares, &last_level))
+			return false;
+		is_generated = true;
+	}
+
+	side = job.side;
+	angle = job.angle;
+	reversing = job.reversing;
+
+	is_generated = is_generated || iters < job.iters;
+	while (iters < job.iters)
+	{
+		if (!publish(job, std::shared_ptr<const PythagorasTreeLod>()))
+			return false;
+
+		{
+			ProfileScope level_scope(job.profiler, profile_level, profile_builder_track);
+			if (!appendPythagorasLevel(side, angle, iters, reversing, job.threads, store->squares, last_level))
+				return false;
+		}
+		iters++;
+
+		if (isSuperseded(job))
+			return false;
+	}
+
+	if (job.is_cached && is_generated)
+		savePythagorasCache(job.cache_directory, job.cache_files, side, angle, job.iters, reversing, store->squares);
+
+	std::shared_ptr<PythagorasTreeLod> lod(new PythagorasTreeLod);
+	{
+		ProfileScope lod_scope(job.profiler, profile_lod, profile_builder_track);
+		buildPythagorasTreeLod(store->data, job.iters, *lod);
+	}
+
+	return publish(job, lod);
+}
+
+struct PythagorasTree
+{
+	bool                                   is_instanced;
+	bool                                   is_compact_mesh;
+	bool                                   is_gpu_generated;
+	bool                                   is_cached;
+	std::string                            cache_directory;
+	unsigned int                           cache_files;
+	PythagorasGpuGenerator                 generator;
+	GLfloat                                side;
+	float                                  angle;
+	int                                    iters;
+	bool                                   reversing;
+	std::vector<PythagorasSquare>          squares;
+	PythagorasMesh                         mesh;
+	PythagorasTreeLod                      lod;
+	GLuint                                 squares_buffer;
+	size_t                                 squares_capacity;
+	GLuint                                 iters_buffer;
+	GLuint                                 points_buffer;
+	GLuint                                 points_texture;
+	std::unique_ptr<PythagorasTreeBuilder> builder;
+	unsigned int                           job_id;
+	unsigned int                           complete_job_id;
+	PythagorasTreePart                     part;
+	unsigned int                           shape;
+	size_t                                 uploaded_squares;
+	int                                    ready_iters;
+	bool                                   is_complete;
+	Profiler*                              profiler;
+};
+
+void uploadBufferData(const GLenum target, const GLuint buffer, const size_t size, const GLvoid* data)
+{
+	// Data of the same size is written into the existing storage instead of reallocating it.
+	glBindBuffer(target, buffer);
+
+	GLint current_size = 0;
+	glGetBufferParameteriv(target, GL_BUFFER_SIZE, &current_size);
+
+	if (static_cast<size_t>(current_size) == size)
+		glBufferSubData(target, 0, size, data);
+	else
+		glBufferData(target, size, data, GL_STATIC_DRAW);
+
+	glBindBuffer(target, 0);
+}
+
+void reservePythagorasSquares(PythagorasTree& tree, const size_t size, const size_t first)
+{
+	if (size > tree.squares_capacity)
+	{
+		// A tree growing by a level gets room for one more, and the squares already on the GPU are copied over.
+		const size_t capacity = first == 0 ? size : 2 * size + 1;
+
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(PythagorasSquare), NULL, GL_STATIC_DRAW);
+
+		if (first != 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, tree.squares_buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, first * sizeof(PythagorasSquare));
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &tree.squares_buffer);
+
+		tree.squares_buffer = buffer;
+		tree.squares_capacity = capacity;
+	}
+}
+
+void uploadPythagorasSquares(PythagorasTree& tree, const size_t first)
+{
+	const size_t size = tree.squares.size();
+	reservePythagorasSquares(tree, size, first);
+
+	glBindBuffer(GL_ARRAY_BUFFER, tree.squares_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(PythagorasSquare), (size - first) * sizeof(PythagorasSquare), &tree.squares[first]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void uploadPythagorasMesh(PythagorasTree& tree)
+{
+	const PythagorasMesh& mesh = tree.mesh;
+
+	if (mesh.short_corners.empty())
+		uploadBufferData(GL_ARRAY_BUFFER, tree.squares_buffer, mesh.corners.size() * sizeof(GLuint), mesh.corners.data());
+	else
+		uploadBufferData(GL_ARRAY_BUFFER, tree.squares_buffer, mesh.short_corners.size() * sizeof(GLushort), mesh.short_corners.data());
+
+	uploadBufferData(GL_ARRAY_BUFFER, tree.iters_buffer, mesh.iters.size(), mesh.iters.data());
+	uploadBufferData(GL_TEXTURE_BUFFER, tree.points_buffer, mesh.points.size() * sizeof(GLfloat), mesh.points.data());
+
+	glBindTexture(GL_TEXTURE_BUFFER, tree.points_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, tree.points_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+bool updatePythagorasTree(PythagorasTree&    tree,
+                          const GLfloat      side,
+                          const float        angle,
+                          const int          iters,
+                          const bool         reversing,
+                          const unsigned int threads)
+{
+	if (side == tree.side && angle == tree.angle && iters == tree.iters && reversing == tree.reversing)
+		return true;
+
+	if (!checkPythagorasTreeArguments(side, angle, iters))
+		return false;
+
+	// Instanced squares are numbered by gl_InstanceID, which has to fit a GLsizei.
+	if (tree.is_instanced && iters > 31)
+	{
+		std::cerr << "Subtree instancing supports up to 31 iterations" << std::endl;
+		return false;
+	}
+
+	const bool is_shape_changed = side != tree.side || angle != tree.angle || reversing != tree.reversing;
+	const int old_iters = tree.iters;
+
+	if (tree.builder)
+	{
+		// Squares are generated on the builder thread and picked up by receivePythagorasTree.
+		const PythagorasTreeJob job = { ++tree.job_id, side, angle, iters, reversing, threads, tree.is_cached, tree.cache_directory, tree.cache_files,
+		                                 tree.profiler };
+		tree.builder->request(job);
+
+		// The levels uploaded for the last tree stay drawn as a preview until the parts of this job arrive.
+		tree.part = PythagorasTreePart();
+		tree.is_complete = false;
+	}
+	else if (tree.is_instanced)
+	{
+		// The vertex shader places every square from its index and the angle of the frame, so nothing is generated;
+		// only the cluster roots of the LOD are.
+	}
+	else if (tree.is_compact_mesh)
+	{
+		ProfileScope scope(tree.profiler, profile_generate, profile_main_track);
+
+		// Welded corners are shared across levels, so the mesh is always generated again.
+		if (!genPythagorasMesh(side, angle, iters, reversing, tree.mesh))
+			return false;
+
+		uploadPythagorasMesh(tree);
+	}
+	else
+	{
+		// Levels already in the buffer are kept when the tree only grows, as the GPU expands the last one in place.
+		const int first_iters = !is_shape_changed && iters > old_iters ? old_iters : 0;
+		if (is_shape_changed || iters > old_iters)
+		{
+			ProfileScope scope(tree.profiler, profile_generate, profile_main_track);
+			reservePythagorasSquares(tree, pythagorasTreeSize(iters), pythagorasTreeSize(first_iters));
+			if (!genPythagorasSquaresGpu(tree.generator, side, angle, first_iters, iters, reversing, tree.squares_buffer))
+				return false;
+		}
+	}
+
+	tree.side = side;
+	tree.angle = angle;
+	tree.iters = iters;
+	tree.reversing = reversing;
+
+	if (tree.builder)
+		tree.lod = PythagorasTreeLod();
+	else if (tree.is_compact_mesh)
+		buildPythagorasTreeLod(tree.mesh, iters, tree.lod);
+	else
+		buildPythagorasTreeLod(side, angle, iters, reversing, tree.lod);
+
+	GLenum error;
+	if ((error = glGetError()) != GL_NO_ERROR)
+	{
+		std::cerr << "Buffer data error: " << error << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void receivePythagorasTree(PythagorasTree& tree, const size_t upload_size)
+{
+	// Parts of abandoned jobs are skipped, and of the others the newest one holds all levels before it.
+	PythagorasTreePart part;
+	while (tree.builder->receive(part))
+	{
+		if (part.id != tree.job_id)
+			continue;
+
+		tree.part = part;
+		tree.is_complete = false;
+	}
+
+	if (tree.is_complete || !tree.part.store)
+		return;
+
+	if (tree.part.store->shape != tree.shape)
+	{
+		tree.shape = tree.part.store->shape;
+		tree.uploaded_squares = 0;
+	}
+
+	// Squares of the same shape stay valid in the buffer, and large trees are uploaded over several frames.
+	const size_t size = pythagorasTreeSize(tree.part.iters);
+	if (tree.uploaded_squares < size)
+	{
+		const size_t first = tree.uploaded_squares;
+		const size_t last = std::min(size, first + std::max(upload_size / sizeof(PythagorasSquare), static_cast<size_t>(1)));
+		reservePythagorasSquares(tree, size, first);
+
+		glBindBuffer(GL_ARRAY_BUFFER, tree.squares_buffer);
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(PythagorasSquare), (last - first) * sizeof(PythagorasSquare), tree.part.store->data + first);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		tree.uploaded_squares = last;
+	}
+
+	tree.ready_iters = tree.part.iters;
+	while (pythagorasTreeSize(tree.ready_iters) > tree.uploaded_squares)
+		tree.ready_iters--;
+
+	if (tree.part.lod && tree.ready_iters == tree.part.iters)
+	{
+		tree.lod = *tree.part.lod;
+		tree.complete_job_id = tree.part.id;
+		tree.is_complete = true;
+	}
+}
+
+bool isPythagorasTreeChanging(const PythagorasTree& tree, const Settings& settings)
+{
+	// Every frame looks different while the light turns, the angle swings or a requested tree is still arriving.
+	return settings.is_dynamic_light || (tree.is_instanced && settings.angle_animation != 0.f) ||
+	       (tree.builder && tree.complete_job_id != tree.job_id);
+}
+
+bool createPythagorasTree(PythagorasTree&    tree,
+                          const bool         is_instanced,
+                          const bool         is_compact_mesh,
+                          const bool         is_gpu_generated,
+                          const bool         is_cached,
+                          const std::string& cache_directory,
+                          const unsigned int cache_files,
+                          const GLfloat      side,
+                          const float        angle,
+                          const int          iters,
+                          const bool         reversing,
+                          const unsigned int threads,
+                          Profiler*          profiler)
+{
+	tree.is_instanced = is_instanced;
+	tree.is_compact_mesh = is_compact_mesh && !is_instanced;
+	tree.is_gpu_generated = is_gpu_generated && !tree.is_compact_mesh && !is_instanced;
+	tree.is_cached = is_cached;
+	tree.cache_directory = cache_directory;
+	tree.cache_files = cache_files;
+	tree.side = 0.f;
+	tree.angle = 0.f;
+	tree.iters = 0;
+	tree.reversing = reversing;
+	tree.squares_capacity = 0;
+	tree.job_id = 0;
+	tree.complete_job_id = 0;
+	tree.shape = 0;
+	tree.uploaded_squares = 0;
+	tree.ready_iters = 0;
+	tree.is_complete = false;
+	tree.profiler = profiler;
+
+	glGenBuffers(1, &tree.squares_buffer);
+	glGenBuffers(1, &tree.iters_buffer);
+	glGenBuffers(1, &tree.points_buffer);
+	glGenTextures(1, &tree.points_texture);
+
+	if (tree.is_gpu_generated && !createPythagorasGpuGenerator(GLEW_VERSION_4_3, tree.generator))
+		return false;
+
+	if (!tree.is_instanced && !tree.is_compact_mesh && !tree.is_gpu_generated)
+		tree.builder.reset(new PythagorasTreeBuilder);
+
+	return updatePythagorasTree(tree, side, angle, iters, reversing, threads);
+}
+
+bool settingsStamp(const std::string& file, std::pair<time_t, long long>& stamp)
+{
+	struct stat info;
+	if (stat(file.c_str(), &info) != 0)
+		return false;
+
+	// The size catches edits made within the same second on file systems with coarse timestamps.
+	stamp = std::make_pair(info.st_mtime, info.st_size);
+
+	return true;
+}
+
+class BatchQueue
+{
+public:
+	BatchQueue();
+
+	void push(const size_t slot);
+	bool pop(size_t& slot);
+	void close();
+
+private:
+	std::mutex              mutex;
+	std::condition_variable slot_pushed;
+	std::deque<size_t>      slots;
+	bool                    is_closed;
+};
+
+BatchQueue::BatchQueue()
+	: is_closed(false)
+{
+}
+
+void BatchQueue::push(const size_t slot)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		slots.push_back(slot);
+	}
+	slot_pushed.notify_one();
+}
+
+bool BatchQueue::pop(size_t& slot)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	slot_pushed.wait(lock, [this] { return !slots.empty() || is_closed; });
+
+	if (slots.empty())
+		return false;
+
+	slot = slots.front();
+	slots.pop_front();
+	return true;
+}
+
+void BatchQueue::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_closed = true;
+	}
+	slot_pushed.notify_all();
+}
+
+struct BatchTree
+{
+	size_t                        job;
+	std::vector<PythagorasSquare> squares;
+	PythagorasTreeLod             lod;
+};
+
+struct BatchImage
+{
+	size_t                     job;
+	std::vector<unsigned char> color;
+	std::vector<unsigned char> pixels;
+};
+
+bool loadBatchJobs(const std::string& file_name, const Settings& settings, std::vector<Settings>& jobs)
+{
+	std::ifstream file(file_name);
+	if (!file.good())
+	{
+		std::cerr << "Cannot open " + file_name + " batch file" << std::endl;
+		return false;
+	}
+
+	// Every line is one tree: "Label=value" settings separated by ';' applied over settings.txt.
+	bool is_valid = true;
+
+	std::string line;
+	for (int line_number = 1; std::getline(file, line); line_number++)
+	{
+		const std::string position = file_name + ":" + std::to_string(line_number) + ": ";
+
+		size_t first = 0;
+		size_t last = std::min(line.find('#'), line.size());
+		trimSetting(line, first, last);
+		if (first == last)
+			continue;
+
+		std::vector<std::string> overrides;
+		while (first < last)
+		{
+			const size_t separator = std::min(line.find(';', first), last);
+
+			size_t override_first = first;
+			size_t override_last = separator;
+			trimSetting(line, override_first, override_last);
+
+			// Spaces around '=' are allowed here, since the labels already contain spaces.
+			std::string text = line.substr(override_first, override_last - override_first);
+			const size_t equals = text.find('=');
+			if (equals != std::string::npos)
+			{
+				size_t label_first = 0;
+				size_t label_last = equals;
+				size_t value_first = equals + 1;
+				size_t value_last = text.size();
+				trimSetting(text, label_first, label_last);
+				trimSetting(text, value_first, value_last);
+				text = text.substr(label_first, label_last - label_first) + "=" + text.substr(value_first, value_last - value_first);
+			}
 
-	if (!file)
-	{
-		std::cerr << "Bad data in settings file" << std::endl;
-		std::cin.get();
-		return false;
-	}
+			if (!text.empty())
+				overrides.push_back(text);
+			first = separator + 1;
+		}
 
-	std::stringstream sstream;
-	sstream << line;
-	std::string s;
-	for (int i = 0; i < labels_numbers_of_words[line_number - 1]; i++)
-		sstream >> s;
-
-	if (typeid(setting) == typeid(bool))
-		sstream >> std::boolalpha >> setting;
-	else if (typeid(setting) == typeid(int))
-		sstream >> std::hex >> setting;
-	else
-		sstream >> setting;
+		Settings job = settings;
+		if (!applySettingOverrides(overrides, position, job))
+			is_valid = false;
+		else if (!isValidPythagorasTree(job.side, job.angle, job.iters))
+		{
+			std::cerr << position + "wrong side length, left angle or iterations" << std::endl;
+			is_valid = false;
+		}
+		else
+			jobs.push_back(job);
+	}
 
-	if (!sstream)
+	if (is_valid && jobs.empty())
 	{
-		std::cerr << "Bad data in settings file" << std::endl;
-		std::cin.get();
-		return false;
+		std::cerr << file_name + ": no trees in batch file" << std::endl;
+		is_valid = false;
 	}
 
-	file.seekg(0);
-
-	return true;
+	return is_valid;
 }
 
-bool loadSettings(const std::string& file_name,
-                  bool&              is_3d,
-                  int&               iters,
-                  GLfloat&           side,
-                  GLfloat&           depth,
-                  float&             angle,
-                  glm::vec3&         first_color,
-                  glm::vec3&         last_color,
-                  bool&              reversing,
-                  bool&              is_directed_light,
-                  bool&              is_dynamic_light)
+bool runBatch(const Options& options, const Settings& settings)
 {
-	std::fstream file(file_name);
-	if (!file.good())
-	{
-		std::cerr << "Cannot open " + file_name + " settings file" << std::endl;
-		std::cin.get();
+	std::vector<Settings> jobs;
+	if (!loadBatchJobs(options.batch_file, settings, jobs))
 		return false;
-	}
-
-	int labels_numbers_of_words[10] = {2, 1, 2, 2, 2, 3, 3, 3, 3, 3};
 
-	if (!loadSetting(file, labels_numbers_of_words, is_3d, 1) ||
-	    !loadSetting(file, labels_numbers_of_words, iters, 2) ||
-	    !loadSetting(file, labels_numbers_of_words, side, 3)  ||
-	    !loadSetting(file, labels_numbers_of_words, depth, 4) ||
-	    !loadSetting(file, labels_numbers_of_words, angle, 5))
-	{
+	ShaderProgram program;
+	if (!createTreeProgram("pt_vertex_shader.vert", program))
 		return false;
-	}
 
-	int first_color_int;
-	if (!loadSetting(file, labels_numbers_of_words, first_color_int, 6))
-		return false;
+	const GLint first_color_location = uniformLocation(program, "first_color");
+	const GLint last_color_location = uniformLocation(program, "last_color");
+	const GLint is_directed_light_location = uniformLocation(program, "is_directed_light");
+	const GLint depth_location = uniformLocation(program, "depth");
+	const GLint last_iter_location = uniformLocation(program, "last_iter");
 
-	first_color.x = (first_color_int & 0xff0000) / glm::pow(255.f, 3);
-	first_color.y = (first_color_int & 0xff00) / glm::pow(255.f, 2);
-	first_color.z = (first_color_int & 0xff) / 255.f;
+	const GLuint frame_binding = 0;
+	bindUniformBlock(program, "Frame", frame_binding);
 
-	int last_color_int;
-	if (!loadSetting(file, labels_numbers_of_words, last_color_int, 7))
-		return false;
+	GLuint frame_buffer;
+	glGenBuffers(1, &frame_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, frame_binding, frame_buffer);
 
-	last_color.x = (last_color_int & 0xff0000) / glm::pow(255.f, 3);
-	last_color.y = (last_color_int & 0xff00) / glm::pow(255.f, 2);
-	last_color.z = (last_color_int & 0xff) / 255.f;
+	GLuint vertex_array;
+	glGenVertexArrays(1, &vertex_array);
 
-	if (!loadSetting(file, labels_numbers_of_words, reversing, 8)         ||
-	    !loadSetting(file, labels_numbers_of_words, is_directed_light, 9) ||
-	    !loadSetting(file, labels_numbers_of_words, is_dynamic_light, 10))
-	{
-		return false;
-	}
+	GLuint elements_buffer;
+	glGenBuffers(1, &elements_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_elements), cube_elements, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	if (!file)
+	// Every tree is drawn into the same offscreen target, so the window size does not matter.
+	const int raster_width = options.width * options.supersampling;
+	const int raster_height = options.height * options.supersampling;
+
+	GLuint renderbuffers[2];
+	glGenRenderbuffers(2, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, raster_width, raster_height);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, raster_width, raster_height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLuint framebuffer;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 	{
-		std::cerr << "Bad data in settings file" << std::endl;
-		std::cin.get();
+		std::cerr << "Cannot create " + std::to_string(raster_width) + "x" + std::to_string(raster_height) + " batch framebuffer" << std::endl;
 		return false;
 	}
 
-	return true;
-}
+	glViewport(0, 0, raster_width, raster_height);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-void _genPythagorasTree(const GLfloat         side,
-                        const GLfloat         depth,
-                        const float           angle,
-                        const float           abs_angle,
-                        const int             iter,
-                        const int             last_iter,
-                        const float           prev_side,
-                        const bool            is_left,
-                        const bool            prev_is_left,
-                        const bool            reversing,
-                        glm::mat4             trans,
-                        std::vector<GLfloat>& vertices,
-                        std::vector<GLfloat>& normals,
-                        std::vector<int>&     iters)
-{
-	if (iter == last_iter + 1)
-		return;
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	glClearColor(1.f, 1.f, 1.f, 1.f);
 
-	glm::vec3 offset(prev_side, 0.f, 0.f);
-	if (is_left)
-		offset = glm::rotate(offset, glm::radians(abs_angle - angle), glm::vec3(0.f, 0.f, 1.f));
-	else
-		offset = glm::rotate(offset, glm::radians(abs_angle + 90.f - angle), glm::vec3(0.f, 0.f, 1.f));
-	offset = glm::rotate(offset, glm::radians(90.f), glm::vec3(0.f, 0.f, 1.f));
-	trans = glm::translate(trans, offset);
+	// The squares buffer only grows, so a sweep reallocates it at most once per new largest tree.
+	PythagorasTree tree;
+	tree.is_instanced = false;
+	tree.is_compact_mesh = false;
+	tree.squares_buffer = 0;
+	tree.squares_capacity = 0;
+	tree.iters_buffer = 0;
+
+	const float window_ratio = static_cast<float>(options.width) / options.height;
+
+	glm::vec3 camera_position(0.f, 0.f, options.camera_distance);
+	camera_position = glm::rotate(camera_position, glm::radians(options.camera_pitch), glm::vec3(-1.f, 0.f, 0.f));
+	camera_position = glm::rotate(camera_position, glm::radians(options.camera_yaw), glm::vec3(0.f, 1.f, 0.f));
 
-	if (prev_is_left)
+	// Tree N + 1 is generated and image N - 1 is written while tree N is drawn. Two slots per stage keep every
+	// stage busy, and the vectors in them keep their storage from one tree to the next.
+	BatchTree trees[2];
+	BatchImage images[2];
+	BatchQueue free_trees;
+	BatchQueue generated_trees;
+	BatchQueue free_images;
+	BatchQueue rendered_images;
+
+	for (size_t i = 0; i < 2; i++)
 	{
-		if (!is_left)
-		{
-			offset = glm::rotate(offset, glm::radians(-90.f), glm::vec3(0.f, 0.f, 1.f));
-			trans = glm::translate(trans, offset);
-		}
+		free_trees.push(i);
+		images[i].color.resize(static_cast<size_t>(raster_width) * raster_height * 3);
+		images[i].pixels.resize(static_cast<size_t>(options.width) * options.height * 3);
+		free_images.push(i);
 	}
-	else
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::thread generator([&]
 	{
-		if (is_left)
+		size_t slot;
+		for (size_t job = 0; job < jobs.size() && free_trees.pop(slot); job++)
 		{
-			offset = glm::rotate(offset, glm::radians(90.f), glm::vec3(0.f, 0.f, 1.f));
-			trans = glm::translate(trans, offset);
+			BatchTree& batch_tree = trees[slot];
+			batch_tree.job = job;
+			genPythagorasSquares(jobs[job].side, jobs[job].angle, jobs[job].iters, jobs[job].reversing, jobs[job].threads, batch_tree.squares, NULL);
+			buildPythagorasTreeLod(batch_tree.squares.data(), jobs[job].iters, batch_tree.lod);
+			generated_trees.push(slot);
 		}
-	}
 
-	glm::vec4 v[4] =
-	{
-		glm::vec4(0.f, side, depth, 1.f),
-		glm::vec4(side, side, depth, 1.f),
-		glm::vec4(side, 0.f, depth, 1.f),
-		glm::vec4(0.f, 0.f, depth, 1.f)
-	};
+		generated_trees.close();
+	});
 
-	glm::vec2 n[4] =
-	{
-		glm::vec2(-1.f,  1.f),
-		glm::vec2(1.f,  1.f),
-		glm::vec2(1.f, -1.f),
-		glm::vec2(-1.f, -1.f)
-	};
+	bool is_written = true;
 
-	if (is_left)
+	std::thread writer([&]
 	{
-		for (int i = 0; i < 4; i++)
+		size_t slot;
+		while (rendered_images.pop(slot))
 		{
-			v[i] = glm::rotate(v[i], glm::radians(abs_angle), glm::vec3(0.f, 0.f, 1.f));
-			n[i] = glm::rotate(n[i], glm::radians(abs_angle));
+			BatchImage& image = images[slot];
+			resolveSupersampling(image.color.data(), options.width, options.height, options.supersampling, true, image.pixels.data());
+
+			const std::string file_name = frameFileName(options.output, static_cast<int>(image.job), static_cast<int>(jobs.size()));
+
+			ImageWriter image_writer;
+			if (image_writer.open(file_name, options.width, options.height) &&
+			    image_writer.writeRows(image.pixels.data(), options.height) &&
+			    image_writer.close())
+			{
+				std::cout << "Rendered " + file_name << std::endl;
+			}
+			else
+				is_written = false;
+
+			free_images.push(slot);
 		}
-	}
-	else
+	});
+
+	std::vector<PythagorasRange> ranges;
+
+	size_t tree_slot;
+	while (generated_trees.pop(tree_slot))
 	{
-		for (int i = 0; i < 4; i++)
+		BatchTree& batch_tree = trees[tree_slot];
+		const Settings& job = jobs[batch_tree.job];
+		const size_t job_index = batch_tree.job;
+
+		// Swapping hands the previous tree's storage back to the generator along with the slot.
+		tree.squares.swap(batch_tree.squares);
+		std::swap(tree.lod, batch_tree.lod);
+		free_trees.push(tree_slot);
+
+		uploadPythagorasSquares(tree, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		glUseProgram(program.id);
+
+		FrameUniforms frame;
+		frame.mvp_matrix = treeMvpMatrix(job.is_3d, camera_position, options.ortho_position, options.ortho_width, options.ortho_width / window_ratio, window_ratio, job.side);
+		frame.light_direction = glm::vec4(0.f, 0.f, -1.f, 0.f);
+
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glUniform3f(first_color_location, job.first_color.x, job.first_color.y, job.first_color.z);
+		glUniform3f(last_color_location, job.last_color.x, job.last_color.y, job.last_color.z);
+		glUniform1i(is_directed_light_location, job.is_directed_light);
+		glUniform1f(depth_location, job.depth);
+		glUniform1i(last_iter_location, job.iters);
+
+		selectPythagorasTreeRanges(tree.lod, frame.mvp_matrix, glm::vec2(raster_width, raster_height), job.lod_pixels, job.depth, ranges);
+
+		glBindVertexArray(vertex_array);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements_buffer);
+		enablePythagorasInstances(program, false);
+
+		for (size_t i = 0; i < ranges.size(); i++)
 		{
-			v[i] = glm::rotate(v[i], glm::radians(abs_angle + 90.f), glm::vec3(0.f, 0.f, 1.f));
-			n[i] = glm::rotate(n[i], glm::radians(abs_angle + 90.f));
+			bindPythagorasInstances(program, false, false, tree.squares_buffer, tree.iters_buffer, ranges[i].first);
+			glDrawElementsInstanced(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, NULL, static_cast<GLsizei>(ranges[i].count));
 		}
-	}
-
-	for (int i = 0; i < 4; i++)
-		v[i] = trans * v[i];
 
-	for (int i = 0; i < 4; i++)
-	{
-		vertices.push_back(v[i].x);
-		vertices.push_back(v[i].y);
-		vertices.push_back(v[i].z / 2.f);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		glUseProgram(0);
 
-		normals.push_back(n[i].x);
-		normals.push_back(n[i].y);
-		normals.push_back(1.f);
-	}
-	for (int i = 0; i < 4; i++)
-	{
-		vertices.push_back(v[i].x);
-		vertices.push_back(v[i].y);
-		vertices.push_back(-v[i].z / 2.f);
-
-		normals.push_back(n[i].x);
-		normals.push_back(n[i].y);
-		normals.push_back(-1.f);
-	}
-
-	iters.push_back(iter);
-
-	if (iter == 1 || !reversing)
-	{
-		_genPythagorasTree(glm::sin(glm::radians(180.f - 90.f - angle)) * side,
-		                   depth,
-		                   angle,
-		                   abs_angle + angle,
-		                   iter + 1,
-		                   last_iter,
-		                   side,
-		                   true,
-		                   is_left,
-		                   reversing,
-		                   trans,
-		                   vertices,
-		                   normals,
-		                   iters);
-
-		_genPythagorasTree(glm::sin(glm::radians(angle)) * side,
-		                   depth,
-		                   angle,
-		                   abs_angle - (90.f - angle),
-		                   iter + 1,
-		                   last_iter,
-		                   side,
-		                   false,
-		                   is_left,
-		                   reversing,
-		                   trans,
-		                   vertices,
-		                   normals,
-		                   iters);
-	}
-	else if (iter % 2 == 1 && reversing)
-	{
-		_genPythagorasTree(glm::sin(glm::radians(angle)) * side,
-		                   depth,
-		                   90.f - angle,
-		                   abs_angle + (90.f - angle),
-		                   iter + 1,
-		                   last_iter,
-		                   side,
-		                   true,
-		                   is_left,
-		                   reversing,
-		                   trans,
-		                   vertices,
-		                   normals,
-		                   iters);
-
-		_genPythagorasTree(glm::sin(glm::radians(180.f - 90.f - angle)) * side,
-		                   depth,
-		                   90.f - angle,
-		                   abs_angle - angle,
-		                   iter + 1,
-		                   last_iter,
-		                   side,
-		                   false,
-		                   is_left,
-		                   reversing, 
-		                   trans,
-		                   vertices,
-		                   normals,
-		                   iters);
-	}
-	else if (reversing)
-	{
-		_genPythagorasTree(glm::sin(glm::radians(angle)) * side,
-		                   depth,
-		                   90.f - angle,
-		                   abs_angle + (90.f - angle),
-		                   iter + 1,
-		                   last_iter,
-		                   side,
-		                   true,
-		                   is_left,
-		                   reversing,
-		                   trans,
-		                   vertices,
-		                   normals,
-		                   iters);
-
-		_genPythagorasTree(glm::sin(glm::radians(180.f - 90.f - angle)) * side,
-		                   depth,
-		                   90.f - angle,
-		                   abs_angle - angle,
-		                   iter + 1,
-		                   last_iter,
-		                   side,
-		                   false,
-		                   is_left,
-		                   reversing,
-		                   trans,
-		                   vertices,
-		                   normals,
-		                   iters);
-	}
-}
-
-bool genPythagorasTree(const GLfloat         side,
-                       const GLfloat         depth,
-                       const float           angle,
-                       const int             iters,
-                       const bool            reversing,
-                       std::vector<GLfloat>& vertices,
-                       std::vector<GLfloat>& normals,
-                       std::vector<int>&     _iters)
-{
-	if (side <= 0.f || angle <= 0.f || angle >= 90.f || iters <= 0)
-	{
-		std::cerr << "Wrong Pythagoras Tree function argument(s)" << std::endl;
-		std::cin.get();
-		return false;
+		size_t image_slot;
+		free_images.pop(image_slot);
+		images[image_slot].job = job_index;
+		glReadPixels(0, 0, raster_width, raster_height, GL_RGB, GL_UNSIGNED_BYTE, images[image_slot].color.data());
+		rendered_images.push(image_slot);
 	}
 
-	_genPythagorasTree(side, depth, angle, 0.f, 1, iters, 0.f, true, true, reversing, glm::mat4(), vertices, normals, _iters);
+	rendered_images.close();
+	generator.join();
+	writer.join();
 
-	return true;
+	const double seconds = elapsedMilliseconds(start) / 1000.0;
+	std::cout << std::to_string(jobs.size()) + " trees in " + std::to_string(seconds) + " s, " + std::to_string(jobs.size() / seconds) + " trees per second" << std::endl;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(2, renderbuffers);
+	glDeleteBuffers(1, &tree.squares_buffer);
+	glDeleteBuffers(1, &elements_buffer);
+	glDeleteVertexArrays(1, &vertex_array);
+	glDeleteBuffers(1, &frame_buffer);
+	glDeleteProgram(program.id);
+
+	return is_written;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+	Options options;
+	if (!parseOptions(argc, argv, options))
+		return EXIT_FAILURE;
+
+	if (!options.export_file.empty())
+		return exportTree(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (!options.stream_file.empty())
+		return streamTree(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (options.is_analyzing)
+		return analyzeTree(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (options.is_picking || options.is_querying)
+		return queryTree(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (options.is_benchmark)
+		return runBenchmark(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (options.is_poster)
+		return renderPoster(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (options.is_headless)
+		return renderHeadless(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	Settings settings;
+	if (!loadSettings("settings.txt", options.profile, options.settings_overrides, settings))
+		return EXIT_FAILURE;
+
 	const int window_x = 600;
 	const int window_y = 600;
 
-	sf::Window window(sf::VideoMode(window_x, window_y), "PythagorasTree", sf::Style::Default, sf::ContextSettings(24, 0, 8, 4, 3));
+	// In on-demand mode the samples are kept in the frame target instead of the window.
+	const bool is_on_demand = settings.is_on_demand && !options.is_verifying_gpu && options.batch_file.empty();
+	sf::Window window(sf::VideoMode(window_x, window_y), "PythagorasTree", sf::Style::Default, sf::ContextSettings(24, 0, is_on_demand ? 0 : 8, 4, 3));
 	window.setFramerateLimit(100);
 
+	if (options.is_verifying_gpu || !options.batch_file.empty())
+		window.setVisible(false);
+
 	if (glewInit() != GLEW_OK)
 	{
 		std::cerr << "GLEW init error" << std::endl;
-		std::cin.get();
 		return EXIT_FAILURE;
 	}
 
-	if (!GLEW_VERSION_3_2)
+	if (!GLEW_VERSION_3_3)
 	{
 		std::cerr << "Too old OpenGL version" << std::endl;
-		std::cin.get();
 		return EXIT_FAILURE;
 	}
 
-	std::vector<GLfloat> vertices;
-	std::vector<GLfloat> normals;
-	std::vector<int> _iters;
-
-	bool      is_3d;
-	int       iters;
-	GLfloat   side;
-	GLfloat   depth;
-	float     angle;
-	glm::vec3 first_color;
-	glm::vec3 last_color;
-	bool      reversing;
-	bool      is_directed_light;
-	bool      is_dynamic_light;
-
-	if (!loadSettings("settings.txt", is_3d, iters, side, depth, angle, first_color, last_color, reversing, is_directed_light, is_dynamic_light))
-		return EXIT_FAILURE;
-
-	if (!genPythagorasTree(side, depth, angle, iters, reversing, vertices, normals, _iters))
-		return EXIT_FAILURE;
-
-	GLuint vert_shader;
-	if (!createShader("pt_vertex_shader.vert", GL_VERTEX_SHADER, vert_shader))
-		return EXIT_FAILURE;
-
-	GLuint frag_shader;
-	if (!createShader("pt_fragment_shader.frag", GL_FRAGMENT_SHADER, frag_shader))
-		return EXIT_FAILURE;
+	if (options.is_verifying_gpu)
+		return verifyGpuGeneration(settings.side, settings.angle, settings.iters, settings.reversing, settings.threads) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-	std::vector<GLuint> shaders;
-	shaders.push_back(vert_shader);
-	shaders.push_back(frag_shader);
+	if (!options.batch_file.empty())
+		return runBatch(options, settings) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-	GLuint program;
-	if (!createProgram(shaders, program))
+	if (settings.angle_animation != 0.f && settings.animation_period <= 0.f)
+	{
+		std::cerr << "Animation period has to be positive" << std::endl;
 		return EXIT_FAILURE;
+	}
 
-	GLuint vertex_array;
-	glGenVertexArrays(1, &vertex_array);
-	glBindVertexArray(vertex_array);
-
-	GLuint vertices_buffer;
-	glGenBuffers(1, &vertices_buffer);
-		
-	glBindBuffer(GL_ARRAY_BUFFER, vertices_buffer);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+	Profiler profiler;
+	profiler.start(options.is_reporting_stats, !options.trace_file.empty());
 
-	GLenum error;
-	if ((error = glGetError()) != GL_NO_ERROR)
+	PythagorasTree tree;
+	if (!createPythagorasTree(tree, settings.is_instanced || settings.angle_animation != 0.f, settings.is_compact_mesh, settings.is_gpu_generated, settings.is_cached,
+	                          settings.cache_directory, settings.cache_files, settings.side, settings.angle, settings.iters, settings.reversing, settings.threads, &profiler))
 	{
-		std::cerr << "Buffer data error: " << error << std::endl;
-		std::cin.get();
 		return EXIT_FAILURE;
 	}
 
-	glVertexAttribPointer(glGetAttribLocation(program, "in_position"), 3, GL_FLOAT, GL_FALSE, 0, NULL);
-	glEnableVertexAttribArray(glGetAttribLocation(program, "in_position"));
+	std::vector<PythagorasRange> ranges;
 
-	GLuint normals_buffer;
-	glGenBuffers(1, &normals_buffer);
+	ShaderProgram program;
+	if (!createTreeProgram(tree.is_instanced ? "pt_instanced_vertex_shader.vert" : tree.is_compact_mesh ? "pt_mesh_vertex_shader.vert" : "pt_vertex_shader.vert", program))
+		return EXIT_FAILURE;
 
-	glBindBuffer(GL_ARRAY_BUFFER, normals_buffer);
+	const GLint first_color_location = uniformLocation(program, "first_color");
+	const GLint last_color_location = uniformLocation(program, "last_color");
+	const GLint is_directed_light_location = uniformLocation(program, "is_directed_light");
+	const GLint depth_location = uniformLocation(program, "depth");
+	const GLint last_iter_location = uniformLocation(program, "last_iter");
+	const GLint side_location = uniformLocation(program, "side");
+	const GLint turns_location = uniformLocation(program, "turns[0]");
+	const GLint first_square_location = uniformLocation(program, "first_square");
 
-	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GLfloat), normals.data(), GL_STATIC_DRAW);
+	glUseProgram(program.id);
+	glUniform1i(uniformLocation(program, "points"), 0);
+	glUseProgram(0);
 
-	glVertexAttribPointer(glGetAttribLocation(program, "in_normal"), 3, GL_FLOAT, GL_FALSE, 0, NULL);
-	glEnableVertexAttribArray(glGetAttribLocation(program, "in_normal"));
+	const GLuint frame_binding = 0;
+	bindUniformBlock(program, "Frame", frame_binding);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLuint frame_buffer;
+	glGenBuffers(1, &frame_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, frame_binding, frame_buffer);
 
-	glBindVertexArray(0);
+	// Colors, light mode, depth and iterations are sent again only after they change.
+	bool is_settings_changed = true;
+
+	GLuint vertex_array;
+	glGenVertexArrays(1, &vertex_array);
 
 	GLuint elements_buffer;
 	glGenBuffers(1, &elements_buffer);
 
-	std::vector<GLuint> elements;
-
-	elements.push_back(0);
-	elements.push_back(1);
-	elements.push_back(2);
-
-	elements.push_back(0);
-	elements.push_back(2);
-	elements.push_back(3);
-
-	elements.push_back(1);
-	elements.push_back(5);
-	elements.push_back(6);
-
-	elements.push_back(1);
-	elements.push_back(6);
-	elements.push_back(2);
-
-	elements.push_back(5);
-	elements.push_back(4);
-	elements.push_back(7);
-
-	elements.push_back(5);
-	elements.push_back(7);
-	elements.push_back(6);
-
-	elements.push_back(4);
-	elements.push_back(0);
-	elements.push_back(3);
-
-	elements.push_back(4);
-	elements.push_back(3);
-	elements.push_back(7);
-
-	elements.push_back(4);
-	elements.push_back(5);
-	elements.push_back(1);
-
-	elements.push_back(4);
-	elements.push_back(1);
-	elements.push_back(0);
-
-	elements.push_back(3);
-	elements.push_back(2);
-	elements.push_back(6);
-
-	elements.push_back(3);
-	elements.push_back(6);
-	elements.push_back(7);
-
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements_buffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(GLuint), elements.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_elements), cube_elements, GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	glEnable(GL_DEPTH_TEST);
@@ -600,6 +6123,10 @@ int main()
 
 	glClearColor(1.f, 1.f, 1.f, 1.f);
 
+	FrameTarget frame_target;
+	if (is_on_demand && !createFrameTarget(frame_target, window_x, window_y, 8))
+		return EXIT_FAILURE;
+
 	float window_ratio = static_cast<float>(window_x) / window_y;
 
 	glm::vec3 light_direction(0.f, 0.f, -1.f);
@@ -611,37 +6138,129 @@ int main()
 
 	glm::vec2 ortho_position(0.f, 0.f);
 	const float ortho_velocity = 0.005f;
-	const glm::vec2 ortho_area(20.f, 20.f);
 
 	float ortho_x = 4.f;
 	float ortho_y = ortho_x / window_ratio;
 
 	sf::Vector2i old_mouse_pos = sf::Mouse::getPosition(window);
 
+	std::pair<time_t, long long> settings_stamp(0, 0);
+	settingsStamp("settings.txt", settings_stamp);
+
+	const std::chrono::steady_clock::time_point animation_start = std::chrono::steady_clock::now();
+
 	sf::Event event;
 
 	bool is_closed = false;
 
+	// In on-demand mode a frame is drawn only after something changed the picture, and a frame kept in the target is
+	// presented again when the window comes back to the front.
+	bool is_redraw_needed = true;
+	bool is_present_needed = false;
+
 	while (true)
 	{
-		while (window.pollEvent(event))
+		// The loop sleeps in waitEvent while the picture stays the same; settings.txt is then checked after the next event.
+		bool is_waiting = is_on_demand && !is_redraw_needed && !is_present_needed && !isPythagorasTreeChanging(tree, settings);
+		is_waiting = is_waiting && window.waitEvent(event);
+
+		profiler.begin(profile_events, false);
+
+		while (is_waiting || window.pollEvent(event))
 		{
+			is_waiting = false;
+
 			if (event.type == sf::Event::Closed)
-			{
-				window.close();
 				is_closed = true;
-			}
 
 			if (event.type == sf::Event::Resized)
 			{
 				glViewport(0, 0, window.getSize().x, window.getSize().y);
 				window_ratio = static_cast<float>(window.getSize().x) / window.getSize().y;
 				ortho_y = ortho_x / window_ratio;
+
+				if (is_on_demand && !resizeFrameTarget(frame_target, window.getSize().x, window.getSize().y))
+					is_closed = true;
+				is_redraw_needed = true;
+			}
+
+			if (event.type == sf::Event::GainedFocus)
+				is_present_needed = true;
+
+			if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Right)
+			{
+				// The ray under the cursor from the near to the far plane, in model coordinates of the tree.
+				const glm::mat4 inverse_mvp = glm::inverse(treeMvpMatrix(settings.is_3d, camera_position, ortho_position, ortho_x, ortho_y, window_ratio, tree.side));
+				const glm::vec2 device(2.f * (event.mouseButton.x + 0.5f) / window.getSize().x - 1.f, 1.f - 2.f * (event.mouseButton.y + 0.5f) / window.getSize().y);
+				const glm::vec4 near_point = inverse_mvp * glm::vec4(device, -1.f, 1.f);
+				const glm::vec4 far_point = inverse_mvp * glm::vec4(device, 1.f, 1.f);
+				const glm::dvec3 ray_origin(glm::vec3(near_point) / near_point.w);
+				const glm::dvec3 ray_direction(glm::vec3(far_point) / far_point.w - glm::vec3(near_point) / near_point.w);
+
+				PythagorasSpatialIndex index;
+				buildPythagorasSpatialIndex(tree.side, tree.angle, tree.iters, tree.reversing, index);
+
+				PythagorasHit hit;
+				if (pickPythagorasSquare(index, ray_origin, ray_direction, settings.depth, hit))
+				{
+					std::cout << describePythagorasNode(hit.node, tree.side) << std::endl;
+					window.setTitle("PythagorasTree - iteration " + std::to_string(hit.node.iter) + ", path " + pythagorasNodePath(hit.node));
+				}
+				else
+					window.setTitle("PythagorasTree");
+			}
+
+			if (event.type == sf::Event::KeyPressed)
+			{
+				switch (event.key.code)
+				{
+				case sf::Keyboard::Add:
+				case sf::Keyboard::Equal:
+					updatePythagorasTree(tree, tree.side, tree.angle, tree.iters + 1, tree.reversing, settings.threads);
+					break;
+				case sf::Keyboard::Subtract:
+				case sf::Keyboard::Dash:
+					if (tree.iters > 1)
+						updatePythagorasTree(tree, tree.side, tree.angle, tree.iters - 1, tree.reversing, settings.threads);
+					break;
+				case sf::Keyboard::Right:
+					updatePythagorasTree(tree, tree.side, tree.angle + 1.f, tree.iters, tree.reversing, settings.threads);
+					break;
+				case sf::Keyboard::Left:
+					updatePythagorasTree(tree, tree.side, tree.angle - 1.f, tree.iters, tree.reversing, settings.threads);
+					break;
+				case sf::Keyboard::F:
+				{
+					// The whole tree is fitted into the view with a small margin.
+					const glm::vec4 bounds = treeViewBounds(tree.side, tree.angle, tree.iters, tree.reversing);
+					if (settings.is_3d)
+					{
+						float radius = 0.f;
+						for (int corner = 0; corner < 8; corner++)
+							radius = glm::max(radius, glm::length(glm::vec3(corner & 1 ? bounds.z : bounds.x, corner & 2 ? bounds.w : bounds.y, settings.depth / 2)));
+
+						const float half_fov = glm::min(glm::radians(22.5f), std::atan(glm::tan(glm::radians(22.5f)) * window_ratio));
+						camera_position = glm::normalize(camera_position) * glm::clamp(1.05f * radius / glm::sin(half_fov), 2.f, 30.f);
+					}
+					else
+					{
+						ortho_position = glm::vec2(bounds.x + bounds.z, bounds.y + bounds.w) / 2.f;
+						ortho_x = 1.05f * glm::max(bounds.z - bounds.x, (bounds.w - bounds.y) * window_ratio);
+						ortho_y = ortho_x / window_ratio;
+					}
+					break;
+				}
+				default:
+					break;
+				}
+
+				is_settings_changed = true;
+				is_redraw_needed = true;
 			}
 
 			if (event.type == sf::Event::MouseWheelScrolled)
 			{
-				if (is_3d)
+				if (settings.is_3d)
 				{
 					glm::vec3 camera_position_normalized(camera_position.x / glm::length(camera_position),
 														 camera_position.y / glm::length(camera_position),
@@ -669,12 +6288,56 @@ int main()
 						ortho_y = ortho_x / window_ratio;
 					}
 				}
+
+				is_redraw_needed = true;
 			}
 		}
 
 		if (is_closed)
 			break;
 
+		std::pair<time_t, long long> stamp;
+		if (settingsStamp("settings.txt", stamp) && stamp != settings_stamp)
+		{
+			settings_stamp = stamp;
+
+			// A broken edit keeps the current settings; only the geometry settings that changed regenerate squares.
+			Settings new_settings;
+			if (loadSettings("settings.txt", options.profile, options.settings_overrides, new_settings))
+			{
+				if (new_settings.is_compact_mesh != settings.is_compact_mesh || new_settings.is_gpu_generated != settings.is_gpu_generated ||
+				    new_settings.is_instanced != settings.is_instanced || new_settings.is_on_demand != settings.is_on_demand ||
+				    (new_settings.angle_animation != 0.f && !tree.is_instanced))
+				{
+					std::cerr << "Compact mesh mode, GPU generation, subtree instancing, on-demand rendering and turning angle animation on are applied on restart"
+					          << std::endl;
+				}
+
+				if (tree.is_instanced && new_settings.angle_animation != 0.f && new_settings.animation_period <= 0.f)
+				{
+					std::cerr << "Animation period has to be positive" << std::endl;
+					new_settings.angle_animation = settings.angle_animation;
+					new_settings.animation_period = settings.animation_period;
+				}
+
+				new_settings.is_compact_mesh = settings.is_compact_mesh;
+				new_settings.is_gpu_generated = settings.is_gpu_generated;
+				new_settings.is_instanced = settings.is_instanced;
+				new_settings.is_on_demand = settings.is_on_demand;
+				settings = new_settings;
+				tree.is_cached = settings.is_cached;
+				tree.cache_directory = settings.cache_directory;
+				tree.cache_files = settings.cache_files;
+
+				updatePythagorasTree(tree, settings.side, settings.angle, settings.iters, settings.reversing, settings.threads);
+				is_settings_changed = true;
+				is_redraw_needed = true;
+			}
+		}
+
+		profiler.end(profile_events);
+		profiler.begin(profile_camera, false);
+
 		sf::Vector2i current_mouse_pos = sf::Mouse::getPosition(window);
 
 		sf::Vector2i mouse_delta;
@@ -683,9 +6346,15 @@ int main()
 
 		old_mouse_pos = current_mouse_pos;
 
+		if (mouse_delta.x != 0 || mouse_delta.y != 0)
+			is_redraw_needed = true;
+
+		// The view can be moved as long as its center stays over the tree.
+		const glm::vec4 pan_area = treeViewBounds(tree.side, tree.angle, tree.iters, tree.reversing);
+
 		if (mouse_delta.y > 0)
 		{
-			if (is_3d)
+			if (settings.is_3d)
 			{
 				float camera_angle_delta_x;
 
@@ -703,15 +6372,15 @@ int main()
 			}
 			else
 			{
-				if (ortho_position.y + ortho_velocity * mouse_delta.y > ortho_area.y / 2 - ortho_y / 2)
-					ortho_position.y = ortho_area.y / 2 - ortho_y / 2;
+				if (ortho_position.y + ortho_velocity * mouse_delta.y > pan_area.w)
+					ortho_position.y = pan_area.w;
 				else
 					ortho_position.y += ortho_velocity * mouse_delta.y;
 			}
 		}
 		else if (mouse_delta.y < 0)
 		{
-			if (is_3d)
+			if (settings.is_3d)
 			{
 				float camera_angle_delta_x;
 
@@ -729,90 +6398,197 @@ int main()
 			}
 			else
 			{
-				if (ortho_position.y - ortho_velocity * -mouse_delta.y < -ortho_area.y / 2 + ortho_y / 2)
-					ortho_position.y = -ortho_area.y / 2 + ortho_y / 2;
+				if (ortho_position.y - ortho_velocity * -mouse_delta.y < pan_area.y)
+					ortho_position.y = pan_area.y;
 				else
 					ortho_position.y -= ortho_velocity * -mouse_delta.y;
 			}
 		}
 		if (mouse_delta.x < 0)
 		{
-			if (is_3d)
+			if (settings.is_3d)
 			{
 				camera_position = glm::rotate(camera_position, glm::radians(camera_velocity * -mouse_delta.x), glm::vec3(0.f, 1.f, 0.f));
 				camera_axis_x = glm::rotate(camera_axis_x, glm::radians(camera_velocity * -mouse_delta.x), glm::vec3(0.f, 1.f, 0.f));
 			}
 			else
 			{
-				if (ortho_position.x + ortho_velocity * -mouse_delta.x > ortho_area.x / 2 - ortho_x / 2)
-					ortho_position.x = ortho_area.x / 2 - ortho_x / 2;
+				if (ortho_position.x + ortho_velocity * -mouse_delta.x > pan_area.z)
+					ortho_position.x = pan_area.z;
 				else
 					ortho_position.x += ortho_velocity * -mouse_delta.x;
 			}
 		}
 		else if (mouse_delta.x > 0)
 		{
-			if (is_3d)
+			if (settings.is_3d)
 			{
 				camera_position = glm::rotate(camera_position, glm::radians(-camera_velocity * mouse_delta.x), glm::vec3(0.f, 1.f, 0.f));
 				camera_axis_x = glm::rotate(camera_axis_x, glm::radians(-camera_velocity * mouse_delta.x), glm::vec3(0.f, 1.f, 0.f));
 			}
 			else
 			{
-				if (ortho_position.x - ortho_velocity * mouse_delta.x < -ortho_area.x / 2 + ortho_x / 2)
-					ortho_position.x = -ortho_area.x / 2 + ortho_x / 2;
+				if (ortho_position.x - ortho_velocity * mouse_delta.x < pan_area.x)
+					ortho_position.x = pan_area.x;
 				else
 					ortho_position.x -= ortho_velocity * mouse_delta.x;
 			}
 		}
 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		profiler.end(profile_camera);
 
-		glUseProgram(program);
+		if (is_on_demand && !is_redraw_needed && !isPythagorasTreeChanging(tree, settings))
+		{
+			if (is_present_needed)
+			{
+				presentFrameTarget(frame_target, window.getSize().x, window.getSize().y);
+				window.display();
+				is_present_needed = false;
+			}
+			continue;
+		}
 
-		glm::mat4 view_matrix;
-		if (is_3d)
-			view_matrix = glm::lookAt(camera_position, glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
-		else
-			view_matrix = glm::translate(glm::vec3(-ortho_position.x, -ortho_position.y, -7.f));
+		if (tree.builder)
+		{
+			profiler.begin(profile_upload, true);
+			receivePythagorasTree(tree, 32 << 20);
+			profiler.end(profile_upload);
+		}
 
-		glm::mat4 projection_matrix;
-		if (is_3d)
-			projection_matrix = glm::perspective(glm::radians(45.f), window_ratio, 1.f, 50.f);
-		else
-			projection_matrix = glm::ortho(-ortho_x / 2, ortho_x / 2, -ortho_y / 2, ortho_y / 2, 1.f, 50.f);
+		profiler.begin(profile_uniforms, true);
+
+		if (is_on_demand)
+			glBindFramebuffer(GL_FRAMEBUFFER, frame_target.framebuffer);
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glm::mat4 model_matrix;
-		model_matrix = glm::translate(model_matrix, glm::vec3(-side / 2, -0.5f, 0.f));
+		glUseProgram(program.id);
 
-		glm::mat4 mvp;
-		mvp = projection_matrix * view_matrix * model_matrix;
+		FrameUniforms frame;
+		frame.mvp_matrix = treeMvpMatrix(settings.is_3d, camera_position, ortho_position, ortho_x, ortho_y, window_ratio, tree.side);
 
-		if (is_dynamic_light)
+		if (settings.is_dynamic_light)
 			light_direction = glm::rotate(light_direction, glm::radians(0.3f), glm::vec3(0.f, 1.f, 0.f));
+		frame.light_direction = glm::vec4(light_direction, 0.f);
+
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		if (is_settings_changed)
+		{
+			glUniform3f(first_color_location, settings.first_color.x, settings.first_color.y, settings.first_color.z);
+			glUniform3f(last_color_location, settings.last_color.x, settings.last_color.y, settings.last_color.z);
+			glUniform1i(is_directed_light_location, settings.is_directed_light);
+			glUniform1f(depth_location, settings.depth);
+			glUniform1i(last_iter_location, tree.iters);
+			is_settings_changed = false;
+		}
+
+		profiler.end(profile_uniforms);
+		profiler.begin(profile_draw, true);
 
-		glUniformMatrix4fv(glGetUniformLocation(program, "mvp_matrix"), 1, GL_FALSE, glm::value_ptr(mvp));
-		glUniform3f(glGetUniformLocation(program, "first_color"), first_color.x, first_color.y, first_color.z);
-		glUniform3f(glGetUniformLocation(program, "last_color"), last_color.x, last_color.y, last_color.z);
-		glUniform1i(glGetUniformLocation(program, "is_directed_light"), is_directed_light);
-		glUniform3f(glGetUniformLocation(program, "light_direction"), light_direction.x, light_direction.y, light_direction.z);
+		size_t draw_calls = 0;
+		size_t instances = 0;
+
+		if (tree.is_compact_mesh)
+		{
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_BUFFER, tree.points_texture);
+		}
 
 		glBindVertexArray(vertex_array);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements_buffer);
 
-		for (int i = 0; i < vertices.size() / 24; i++)
+		if (tree.is_instanced)
+		{
+			// Only the side and the angles of the two kinds of levels are sent; the squares have no instance data.
+			float angle = tree.angle;
+			if (settings.angle_animation != 0.f)
+			{
+				const float time = static_cast<float>(elapsedMilliseconds(animation_start) / 1000.0);
+				angle = glm::clamp(tree.angle + settings.angle_animation * glm::sin(glm::radians(360.f) * time / settings.animation_period), 1.f, 89.f);
+			}
+			const float even_angle = pythagorasLevelAngle(angle, 3, tree.reversing);
+
+			const GLfloat turns[4] =
+			{
+				glm::cos(glm::radians(angle)), glm::sin(glm::radians(angle)),
+				glm::cos(glm::radians(even_angle)), glm::sin(glm::radians(even_angle))
+			};
+			glUniform1f(side_location, tree.side);
+			glUniform2fv(turns_location, 2, turns);
+
+			if (angle != tree.angle)
+			{
+				// The clusters of the LOD move with the angle, so the levels large enough on screen are drawn at once.
+				const int visible_iters = visiblePythagorasIters(frame.mvp_matrix, glm::vec2(window.getSize().x, window.getSize().y), settings.lod_pixels,
+				                                                 settings.depth, tree.side, angle, tree.iters, tree.reversing);
+
+				glUniform1i(first_square_location, 0);
+				glDrawElementsInstanced(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, NULL, static_cast<GLsizei>(pythagorasTreeSize(visible_iters)));
+				draw_calls++;
+				instances += pythagorasTreeSize(visible_iters);
+			}
+			else
+			{
+				selectPythagorasTreeRanges(tree.lod, frame.mvp_matrix, glm::vec2(window.getSize().x, window.getSize().y), settings.lod_pixels, settings.depth, ranges);
+
+				for (size_t i = 0; i < ranges.size(); i++)
+				{
+					glUniform1i(first_square_location, static_cast<GLint>(ranges[i].first));
+					glDrawElementsInstanced(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, NULL, static_cast<GLsizei>(ranges[i].count));
+					instances += ranges[i].count;
+				}
+				draw_calls += ranges.size();
+			}
+		}
+		else if (tree.builder && !tree.is_complete)
+		{
+			// While the tree is being built, the levels uploaded so far are drawn as a preview without culling.
+			enablePythagorasInstances(program, false);
+			bindPythagorasInstances(program, false, false, tree.squares_buffer, tree.iters_buffer, 0);
+			glDrawElementsInstanced(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, NULL, static_cast<GLsizei>(pythagorasTreeSize(tree.ready_iters)));
+			draw_calls++;
+			instances += pythagorasTreeSize(tree.ready_iters);
+		}
+		else
 		{
-			glUniform1f(glGetUniformLocation(program, "ratio"), 1.f - (_iters[i] - 1) * (1.f / (iters - 1)));
+			selectPythagorasTreeRanges(tree.lod, frame.mvp_matrix, glm::vec2(window.getSize().x, window.getSize().y), settings.lod_pixels, settings.depth, ranges);
 
-			glDrawElementsBaseVertex(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, NULL, i * 8);
+			enablePythagorasInstances(program, tree.is_compact_mesh);
+			for (size_t i = 0; i < ranges.size(); i++)
+			{
+				bindPythagorasInstances(program, tree.is_compact_mesh, tree.mesh.short_corners.empty(), tree.squares_buffer, tree.iters_buffer, ranges[i].first);
+				glDrawElementsInstanced(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, NULL, static_cast<GLsizei>(ranges[i].count));
+				instances += ranges[i].count;
+			}
+			draw_calls += ranges.size();
 		}
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		glBindVertexArray(0);
 		glUseProgram(0);
 
+		profiler.end(profile_draw);
+		profiler.begin(profile_swap, false);
+
+		if (is_on_demand)
+		{
+			presentFrameTarget(frame_target, window.getSize().x, window.getSize().y);
+			is_redraw_needed = false;
+			is_present_needed = false;
+		}
+
 		window.display();
+
+		profiler.end(profile_swap);
+		profiler.endFrame(window, draw_calls, instances * 12);
 	}
 
-	return EXIT_SUCCESS;
+	// The window keeps its context until the last timer queries are read.
+	const bool is_profiled = profiler.finish(options.trace_file);
+	window.close();
+
+	return is_profiled ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file
@@ -1,17 +1,24 @@
 #version 150
 
+layout(std140) uniform Frame
+{
+	mat4 mvp_matrix;
+	vec3 light_direction;
+};
+
 uniform vec3 first_color;
 uniform vec3 last_color;
 uniform bool is_directed_light;
-uniform float ratio;
-uniform vec3 light_direction;
+uniform int last_iter;
 
 in vec4 inout_normal;
+flat in int inout_iter;
 
 out vec3 out_color;
 
 void main()
 {
+	float ratio = last_iter > 1 ? 1.0 - float(inout_iter - 1) / float(last_iter - 1) : 1.0;
 	vec3 object_color = mix(last_color, first_color, ratio);
 
 	if (is_directed_light)
@@ -0,0 +1,60 @@
+#version 150
+
+uniform float angle;
+uniform bool reversing;
+
+in vec2 in_origin;
+in float in_rotation;
+in float in_side;
+in int in_iter;
+
+out vec2 out_origin;
+out float out_rotation;
+out float out_side;
+flat out int out_iter;
+
+vec2 rotate(vec2 v, float degrees)
+{
+	float a = radians(degrees);
+	return vec2(v.x * cos(a) - v.y * sin(a), v.x * sin(a) + v.y * cos(a));
+}
+
+// Every parent square is an instance drawn as two points, its left and right child, so transform feedback
+// writes the children in level order.
+void main()
+{
+	// Chunks start at an even parent, so the parity of the instance is the one within the level.
+	bool parent_is_left = in_iter == 1 || gl_InstanceID % 2 == 0;
+	float parent_angle = in_rotation - (parent_is_left ? 0.0 : 90.0);
+	bool is_left = gl_VertexID == 0;
+
+	float child_angle;
+	float abs_angle;
+	float side;
+	if (in_iter == 1 || !reversing)
+	{
+		child_angle = angle;
+		abs_angle = is_left ? parent_angle + angle : parent_angle - (90.0 - angle);
+		side = sin(radians(is_left ? 180.0 - 90.0 - angle : angle)) * in_side;
+	}
+	else
+	{
+		child_angle = 90.0 - angle;
+		abs_angle = is_left ? parent_angle + (90.0 - angle) : parent_angle - angle;
+		side = sin(radians(is_left ? angle : 180.0 - 90.0 - angle)) * in_side;
+	}
+
+	vec2 offset = rotate(vec2(in_side, 0.0), is_left ? abs_angle - child_angle : abs_angle + 90.0 - child_angle);
+	offset = rotate(offset, 90.0);
+	vec2 origin = in_origin + offset;
+
+	if (parent_is_left && !is_left)
+		origin += rotate(offset, -90.0);
+	else if (!parent_is_left && is_left)
+		origin += rotate(offset, 90.0);
+
+	out_origin = origin;
+	out_rotation = is_left ? abs_angle : abs_angle + 90.0;
+	out_side = side;
+	out_iter = in_iter + 1;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#version 150
+
+layout(std140) uniform Frame
+{
+	mat4 mvp_matrix;
+	vec3 light_direction;
+};
+
+uniform float depth;
+uniform float side;
+// Cosine and sine of the angle between a square and its left child, for squares of odd and of even iterations.
+// Every subtree is the whole tree or, in reversing mode, its mirror image scaled and turned, so these are all
+// the transforms there are.
+uniform vec2 turns[2];
+// Index of the first square of the draw call, as the LOD draws the tree in ranges.
+uniform int first_square;
+
+out vec4 inout_normal;
+flat out int inout_iter;
+
+const vec2 corners[4] = vec2[4](vec2(0.0, 1.0), vec2(1.0, 1.0), vec2(1.0, 0.0), vec2(0.0, 0.0));
+const vec2 normals[4] = vec2[4](vec2(-1.0, 1.0), vec2(1.0, 1.0), vec2(1.0, -1.0), vec2(-1.0, -1.0));
+
+void main()
+{
+	int corner = gl_VertexID % 4;
+	float face = gl_VertexID < 4 ? 1.0 : -1.0;
+
+	// Squares are laid out level by level, so below its leading bit the instance number + 1 is the path from the
+	// root: 0 for a left child and 1 for a right child.
+	uint path = uint(gl_InstanceID + first_square) + 1u;
+	int iter = 1;
+	while ((path >> uint(iter)) != 0u)
+		iter++;
+
+	// Every square is kept as the corner where its base starts, the direction of its base and its side.
+	vec2 origin = vec2(0.0, 0.0);
+	vec2 direction = vec2(1.0, 0.0);
+	float square_side = side;
+
+	for (int level = 1; level < iter; level++)
+	{
+		vec2 turn = turns[(level + 1) % 2];
+		vec2 left_direction = vec2(direction.x * turn.x - direction.y * turn.y, direction.x * turn.y + direction.y * turn.x);
+
+		origin += vec2(-direction.y, direction.x) * square_side;
+
+		if (((path >> uint(iter - 1 - level)) & 1u) != 0u)
+		{
+			origin += left_direction * square_side * turn.x;
+			direction = vec2(left_direction.y, -left_direction.x);
+			square_side *= turn.y;
+		}
+		else
+		{
+			direction = left_direction;
+			square_side *= turn.x;
+		}
+	}
+
+	mat2 rotation = mat2(direction.x, direction.y, -direction.y, direction.x);
+
+	vec2 position = origin + rotation * (corners[corner] * square_side);
+
+	gl_Position = mvp_matrix * vec4(position, face * depth / 2.0, 1.0);
+	inout_normal = vec4(rotation * normals[corner], face, 1.0);
+	inout_iter = iter;
+}
\ No newline at end of file
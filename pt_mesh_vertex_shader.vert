@@ -0,0 +1,33 @@
+#version 150
+
+layout(std140) uniform Frame
+{
+	mat4 mvp_matrix;
+	vec3 light_direction;
+};
+
+uniform float depth;
+uniform samplerBuffer points;
+
+in uvec4 in_corners;
+in uint in_iter;
+
+out vec4 inout_normal;
+flat out int inout_iter;
+
+const vec2 normals[4] = vec2[4](vec2(-1.0, 1.0), vec2(1.0, 1.0), vec2(1.0, -1.0), vec2(-1.0, -1.0));
+
+void main()
+{
+	int corner = gl_VertexID % 4;
+	float face = gl_VertexID < 4 ? 1.0 : -1.0;
+
+	vec2 position = texelFetch(points, int(in_corners[corner])).xy;
+
+	vec2 top_edge = normalize(texelFetch(points, int(in_corners[1])).xy - texelFetch(points, int(in_corners[0])).xy);
+	mat2 rotation = mat2(top_edge.x, top_edge.y, -top_edge.y, top_edge.x);
+
+	gl_Position = mvp_matrix * vec4(position, face * depth / 2.0, 1.0);
+	inout_normal = vec4(rotation * normals[corner], face, 1.0);
+	inout_iter = int(in_iter);
+}
\ No newline at end of file
@@ -1,14 +1,35 @@
 #version 150
 
-uniform mat4 mvp_matrix;
+layout(std140) uniform Frame
+{
+	mat4 mvp_matrix;
+	vec3 light_direction;
+};
+
+uniform float depth;
 
-in vec4 in_position;
-in vec4 in_normal;
+in vec2 in_origin;
+in float in_rotation;
+in float in_side;
+in int in_iter;
 
 out vec4 inout_normal;
+flat out int inout_iter;
+
+const vec2 corners[4] = vec2[4](vec2(0.0, 1.0), vec2(1.0, 1.0), vec2(1.0, 0.0), vec2(0.0, 0.0));
+const vec2 normals[4] = vec2[4](vec2(-1.0, 1.0), vec2(1.0, 1.0), vec2(1.0, -1.0), vec2(-1.0, -1.0));
 
 void main()
 {
-	gl_Position = mvp_matrix * in_position;
-	inout_normal = in_normal;
+	int corner = gl_VertexID % 4;
+	float face = gl_VertexID < 4 ? 1.0 : -1.0;
+
+	float angle = radians(in_rotation);
+	mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+
+	vec2 position = in_origin + rotation * (corners[corner] * in_side);
+
+	gl_Position = mvp_matrix * vec4(position, face * depth / 2.0, 1.0);
+	inout_normal = vec4(rotation * normals[corner], face, 1.0);
+	inout_iter = in_iter;
 }
\ No newline at end of file